@@ -3,6 +3,7 @@ import sys
 import shutil
 import itertools as it
 import re
+import json
 
 # These two lists are the only things you must add to, or modify
 # TODO - JIP isn't playing nicely currently. 
@@ -16,6 +17,10 @@ hybrids_dir = '/infrastructure/complete_hybrids/'
 prefs_dir =  '/infrastructure/prefetchers/'
 json_config_file = '/infrastructure/json_config_file/ipc_base.json'
 
+# Every generated combination is listed here for run_hybrids.py
+manifest_file = '/hybrids_manifest.json'
+manifest = []
+
 # First, get the hybrid prefetchers' file names 
 # from 'complete_hybrids' directory
 # Parse the file names so that we know what to 
@@ -91,6 +96,43 @@ for h in hybrid_prefetchers:
     # And finally move over prefetch_buffer.cc, which all need
     shutil.copy2(home + prefs_dir + 'prefetch_buffer.cc', home + '/' + comb_dir_name)
 
+    # Structured stats output, which all need
+    shutil.copy2(home + prefs_dir + 'stats_registry.h', home + '/' + comb_dir_name)
+    shutil.copy2(home + prefs_dir + 'stats_registry.cc', home + '/' + comb_dir_name)
+
+    # Per-epoch telemetry, which all need
+    shutil.copy2(home + prefs_dir + 'epoch_telemetry.h', home + '/' + comb_dir_name)
+    shutil.copy2(home + prefs_dir + 'epoch_telemetry.cc', home + '/' + comb_dir_name)
+
+    # Optional stage profiler, header only
+    shutil.copy2(home + prefs_dir + 'hybrid_profile.h', home + '/' + comb_dir_name)
+
+    # Compile-time specialized PPF, header only
+    shutil.copy2(home + prefs_dir + 'static_ppf.h', home + '/' + comb_dir_name)
+
+    # Warm-start checkpoints, which all need
+    shutil.copy2(home + prefs_dir + 'checkpoint.h', home + '/' + comb_dir_name)
+    shutil.copy2(home + prefs_dir + 'checkpoint.cc', home + '/' + comb_dir_name)
+
+    # Runtime parameters from the json config, which all need
+    shutil.copy2(home + prefs_dir + 'hybrid_config.h', home + '/' + comb_dir_name)
+    shutil.copy2(home + prefs_dir + 'hybrid_config.cc', home + '/' + comb_dir_name)
+
+    # Online PPF threshold tuner, which all need
+    shutil.copy2(home + prefs_dir + 'ppf_tuner.h', home + '/' + comb_dir_name)
+    shutil.copy2(home + prefs_dir + 'ppf_tuner.cc', home + '/' + comb_dir_name)
+
+    # Priority-ordered alternative to the prefetch buffer, which all need
+    shutil.copy2(home + prefs_dir + 'priority_prefetch_buffer.h', home + '/' + comb_dir_name)
+    shutil.copy2(home + prefs_dir + 'priority_prefetch_buffer.cc', home + '/' + comb_dir_name)
+
+    # Batched prefetch candidates from the members, header only
+    shutil.copy2(home + prefs_dir + 'pf_batch.h', home + '/' + comb_dir_name)
+
+    # Lead time and lateness of the issued prefetches, which all need
+    shutil.copy2(home + prefs_dir + 'pf_timeliness.h', home + '/' + comb_dir_name)
+    shutil.copy2(home + prefs_dir + 'pf_timeliness.cc', home + '/' + comb_dir_name)
+
     # Now change directory into the new subdir
     os.chdir(home + '/' + comb_dir_name)
 
@@ -138,7 +180,19 @@ for h in hybrid_prefetchers:
       fout.close()
       shutil.move(comb_name + '_new', comb_json_name)
     
+    # Record the combination for the batch runner
+    manifest.append({'name': comb_name,
+                     'dir': comb_dir_name,
+                     'config': comb_json_name,
+                     'hybrid': hybrid_base,
+                     'members': comb_prefs + ['ISCA_Entangling_1Ke_NoShadows']})
+
     # The absolute final step 
     curr_combination = curr_combination + 1
 
   print('-------------------------------------------------------------')
+
+# Write out the manifest of everything we just generated
+with open(home + manifest_file, 'w') as f:
+  json.dump(manifest, f, indent=2)
+print('Wrote ' + str(len(manifest)) + ' combinations to ' + home + manifest_file)
@@ -0,0 +1,897 @@
+// ----------------------------------------------------------------------------
+// Microbenchmarks for the components every hybrid shares: PREFETCH_BUFFER,
+// PPF and SAMPLER. Each benchmark drives one component with a synthetic
+// address stream and reports ns/op and heap allocations/op, so a change to
+// one of them can be checked without running a full simulation.
+//
+// Build from this directory against the same ChampSim headers the hybrids use
+// (add the SHADOW_CACHE sources if your tree keeps them in a .cc):
+//
+//   g++ -O2 -std=c++17 -I<champsim>/inc -I../prefetchers component_bench.cc
+//       ../prefetchers/prefetch_buffer.cc ../prefetchers/ppf.cc
+//       ../prefetchers/set_sampler.cc -o component_bench
+//
+// Usage:
+//   ./component_bench [--ops N] [--reps R] [--stream seq|loop|random|replay:FILE]
+//                     [--filter NAME] [--save FILE] [--baseline FILE] [--tolerance PCT]
+//
+// A replay file holds one hex address per line. --save writes the results as
+// "name stream ns_per_op allocs_per_op" lines; --baseline reads such a file
+// and exits with 1 if any benchmark got slower by more than --tolerance
+// percent (default 10) or allocates more per op.
+//
+// The same binary can replay a randomized program through one member or a
+// whole hybrid and record the prefetches it issues. Add
+// -DREPLAY_MEMBER='"FNL-MMA_12E.inc"' for a member alone, or
+// -DREPLAY_HYBRID='"../complete_hybrids/hybrid_3+sc+ppf.cc"' with its members
+// as -DXXX='"FNL-MMA_12E.inc"' -DYYY='"PIPS_10F.inc"' and the hybrid's other
+// sources, and link checkpoint.cc and stats_registry.cc in both cases:
+//
+//   ./component_bench --pf-replay [--ops N] [--seed S] [--save-seq FILE] [--compare-seq FILE]
+//
+// --ops is the number of L1I accesses here. --save-seq writes one
+// "cycle address member level accepted" line per prefetch. To check that a
+// change keeps the prefetches bit-exact, save the sequence from a build with
+// the files from before it (git show <commit>^:<path>) and compare it with a
+// build of the current ones; --compare-seq exits with 1 at the first
+// prefetch that differs.
+// ----------------------------------------------------------------------------
+
+#if defined(REPLAY_MEMBER) || defined(REPLAY_HYBRID)
+#define REPLAY
+//The replayed code includes ooo_cpu.h, whose guard is set here so it gets
+//the replay's O3_CPU below in place of ChampSim's
+#include "cache.h"
+#define OOO_CPU_H
+#endif
+
+#include "prefetch_buffer.h"
+#include "ppf.h"
+#include "static_ppf.h"
+#include "set_sampler.h"
+#include <algorithm>
+#include <cassert>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <map>
+#include <new>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+// ----------------------------------------------------------------------------
+// Allocation counting. Only this binary replaces the global operators, the
+// hybrids are not affected.
+// ----------------------------------------------------------------------------
+static uint64_t alloc_count = 0;
+
+void *operator new(size_t size){
+  alloc_count++;
+  if(void *p = malloc(size ? size : 1))
+    return p;
+  throw bad_alloc();
+}
+
+void *operator new[](size_t size){
+  alloc_count++;
+  if(void *p = malloc(size ? size : 1))
+    return p;
+  throw bad_alloc();
+}
+
+void operator delete(void *p) noexcept { free(p); }
+void operator delete[](void *p) noexcept { free(p); }
+void operator delete(void *p, size_t) noexcept { free(p); }
+void operator delete[](void *p, size_t) noexcept { free(p); }
+
+// ----------------------------------------------------------------------------
+// Address streams
+// ----------------------------------------------------------------------------
+
+// Code footprint for the looping and random streams, in blocks
+#define BENCH_FOOTPRINT 4096
+
+static uint64_t xorshift(uint64_t &state){
+  state ^= state << 13;
+  state ^= state >> 7;
+  state ^= state << 17;
+  return state;
+}
+
+static vector<uint64_t> make_stream(const string &kind, uint64_t ops){
+  vector<uint64_t> addrs;
+  addrs.reserve(ops);
+  uint64_t base = 0x400000;
+  uint64_t rng = 0x9e3779b97f4a7c15ull;
+
+  if(kind == "seq"){
+    for(uint64_t a = 0; a < ops; a++)
+      addrs.push_back(base + (a << LOG2_BLOCK_SIZE));
+  }else if(kind == "loop"){
+    //A loop body of a few hundred blocks with an occasional call out
+    for(uint64_t a = 0; a < ops; a++){
+      uint64_t blk = a % 384;
+      if(a % 97 == 0)
+        blk = 384 + xorshift(rng) % (BENCH_FOOTPRINT - 384);
+      addrs.push_back(base + (blk << LOG2_BLOCK_SIZE));
+    }
+  }else if(kind == "random"){
+    for(uint64_t a = 0; a < ops; a++)
+      addrs.push_back(base + ((xorshift(rng) % BENCH_FOOTPRINT) << LOG2_BLOCK_SIZE));
+  }else if(kind.compare(0, 7, "replay:") == 0){
+    FILE *f = fopen(kind.c_str() + 7, "r");
+    if(f == NULL){
+      printf("Could not open replay file %s\n", kind.c_str() + 7);
+      exit(2);
+    }
+    vector<uint64_t> trace;
+    unsigned long long addr;
+    while(fscanf(f, "%llx", &addr) == 1)
+      trace.push_back(addr);
+    fclose(f);
+    if(trace.empty()){
+      printf("Replay file %s has no addresses\n", kind.c_str() + 7);
+      exit(2);
+    }
+    //Wrap around so every benchmark sees the same number of ops
+    for(uint64_t a = 0; a < ops; a++)
+      addrs.push_back(trace[a % trace.size()]);
+  }else{
+    printf("Unknown stream %s\n", kind.c_str());
+    exit(2);
+  }
+  return addrs;
+}
+
+// ----------------------------------------------------------------------------
+// Benchmarks. Each one runs the whole stream once and returns the number of
+// operations it performed; setup happens outside the timed region.
+// ----------------------------------------------------------------------------
+
+// Results are folded in here so the compiler cannot drop the calls
+static volatile uint64_t bench_sink;
+
+// Members fed into the prefetch buffer, as in hybrid_3
+#define BENCH_NUM_PFS 3
+
+// PQ slots handed to generate_prefetches every cycle
+#define BENCH_PQ_FREE 4
+
+// The PPF inputs the hybrids would have for a candidate after a demand
+static PPF_CONTEXT make_context(uint64_t pf_addr, uint64_t demand, uint64_t history){
+  PPF_CONTEXT ctx = {pf_addr, demand >> LOG2_BLOCK_SIZE, history, demand,
+      pf_addr >> LOG2_BLOCK_SIZE, history & 0xffff, 0};
+  return ctx;
+}
+
+// ppf.cc's PPF and the compile-time one, with the hybrids' features
+typedef PPF_ADAPTER<PPF_DEFAULT_FEATURES> BENCH_DYNAMIC_PPF;
+typedef STATIC_PPF<PPF_DEFAULT_FEATURES> BENCH_STATIC_PPF;
+
+// One add_pf_entry per candidate, spread over the members like a hybrid's
+// queue drain, and one generate_prefetches per BENCH_NUM_PFS candidates
+struct BENCH_PFB {
+  PREFETCH_BUFFER *pfb;
+  void setup(){ pfb = new PREFETCH_BUFFER(BENCH_NUM_PFS); }
+  void teardown(){ delete pfb; }
+  uint64_t run(const vector<uint64_t> &addrs){
+    uint64_t issued = 0;
+    for(size_t a = 0; a < addrs.size(); a++){
+      uint32_t puid = a % BENCH_NUM_PFS;
+      pfb->add_pf_entry(0, 0, addrs[a] + (puid << LOG2_BLOCK_SIZE), 0, 0, 1, 1, puid, a, -1);
+      if(puid == BENCH_NUM_PFS - 1)
+        issued += pfb->generate_prefetches(BENCH_PQ_FREE, NULL).size();
+    }
+    bench_sink += issued;
+    return addrs.size();
+  }
+};
+
+// check_filter_level on every candidate, including building the features
+template<typename PPF_TYPE>
+struct BENCH_PPF_CHECK {
+  PPF_TYPE *ppf;
+  void setup(){ ppf = new PPF_TYPE(); ppf->initialize(64, 4096, 320, -128, -256); }
+  void teardown(){ delete ppf; }
+  uint64_t run(const vector<uint64_t> &addrs){
+    uint64_t history = 0, accepted = 0;
+    for(size_t a = 0; a < addrs.size(); a++){
+      uint64_t pf_addr = addrs[a] + (1 << LOG2_BLOCK_SIZE);
+      history = (history << 1) | (a & 1);
+      accepted += ppf->check_filter_level(pf_addr, make_context(pf_addr, addrs[a], history)) != PF_REJECT;
+    }
+    bench_sink += accepted;
+    return addrs.size();
+  }
+};
+
+// update_filter on every demand, interleaved with check_filter_level so the
+// tracking tables hold entries and the training paths are exercised
+template<typename PPF_TYPE>
+struct BENCH_PPF_UPDATE {
+  PPF_TYPE *ppf;
+  void setup(){ ppf = new PPF_TYPE(); ppf->initialize(64, 4096, 320, -128, -256); }
+  void teardown(){ delete ppf; }
+  uint64_t run(const vector<uint64_t> &addrs){
+    for(size_t a = 0; a < addrs.size(); a++){
+      if(a % 2 == 0){
+        uint64_t pf_addr = addrs[a] + (1 << LOG2_BLOCK_SIZE);
+        ppf->check_filter_level(pf_addr, make_context(pf_addr, addrs[a], a));
+      }
+      ppf->update_filter(addrs[a], a % 3 == 0);
+    }
+    return addrs.size();
+  }
+};
+
+// STATIC_PPF::score on batches of a demand's next BENCH_BATCH blocks, the
+// gather and sum without the tracking tables
+#define BENCH_BATCH 8
+struct BENCH_SPPF_SCORE {
+  BENCH_STATIC_PPF *ppf;
+  void setup(){ ppf = new BENCH_STATIC_PPF(); ppf->initialize(64, 4096, 320, -128, -256); }
+  void teardown(){ delete ppf; }
+  uint64_t run(const vector<uint64_t> &addrs){
+    PPF_CONTEXT ctx[BENCH_BATCH];
+    int sums[BENCH_BATCH];
+    uint64_t total = 0;
+    for(size_t a = 0; a < addrs.size(); a++){
+      for(int b = 0; b < BENCH_BATCH; b++)
+        ctx[b] = make_context(addrs[a] + ((b + 1) << LOG2_BLOCK_SIZE), addrs[a], a);
+      ppf->score(ctx, BENCH_BATCH, sums);
+      for(int b = 0; b < BENCH_BATCH; b++)
+        total += sums[b];
+    }
+    bench_sink += total;
+    return addrs.size() * BENCH_BATCH;
+  }
+};
+
+// Alternating demand and prefetch updates, as the MEASURE samplers see them
+struct BENCH_SAMPLER {
+  SAMPLER *sampler;
+  void setup(){ sampler = new SAMPLER(); }
+  void teardown(){ delete sampler; }
+  uint64_t run(const vector<uint64_t> &addrs){
+    uint64_t useless = 0;
+    for(size_t a = 0; a < addrs.size(); a++){
+      useless += sampler->update_sampler(addrs[a], 0) != 0;
+      useless += sampler->update_sampler(addrs[a] + (2 << LOG2_BLOCK_SIZE), 1) != 0;
+    }
+    bench_sink += useless;
+    return addrs.size() * 2;
+  }
+};
+
+struct BENCH_RESULT {
+  string name;
+  string stream;
+  double ns_per_op;
+  double allocs_per_op;
+};
+
+// ----------------------------------------------------------------------------
+// Runs a benchmark reps times on fresh state and keeps the fastest run, which
+// is the least noisy estimate on a shared machine
+// ----------------------------------------------------------------------------
+template<typename BENCH>
+static BENCH_RESULT measure(const string &name, const string &stream, const vector<uint64_t> &addrs, int reps){
+  BENCH_RESULT r;
+  r.name = name;
+  r.stream = stream;
+  r.ns_per_op = 0;
+  r.allocs_per_op = 0;
+
+  for(int a = 0; a < reps; a++){
+    BENCH bench;
+    bench.setup();
+    uint64_t allocs = alloc_count;
+    auto start = chrono::steady_clock::now();
+    uint64_t ops = bench.run(addrs);
+    auto end = chrono::steady_clock::now();
+    allocs = alloc_count - allocs;
+    bench.teardown();
+
+    double ns = chrono::duration<double, nano>(end - start).count() / ops;
+    if(a == 0 || ns < r.ns_per_op)
+      r.ns_per_op = ns;
+    r.allocs_per_op = (double)allocs / ops;
+  }
+  return r;
+}
+
+static map<string, BENCH_RESULT> load_results(const char *path){
+  map<string, BENCH_RESULT> results;
+  FILE *f = fopen(path, "r");
+  if(f == NULL){
+    printf("Could not open baseline %s\n", path);
+    exit(2);
+  }
+  char name[256], stream[1024];
+  double ns, allocs;
+  while(fscanf(f, "%255s %1023s %lf %lf", name, stream, &ns, &allocs) == 4){
+    BENCH_RESULT r = {name, stream, ns, allocs};
+    results[r.name + " " + r.stream] = r;
+  }
+  fclose(f);
+  return results;
+}
+
+#ifdef REPLAY
+// ----------------------------------------------------------------------------
+// Prefetch-sequence replay. The member or hybrid runs on this O3_CPU, which
+// records every prefetch it hands to the L1I, over a small L1I model driven
+// by a random walk through a synthetic program. Everything is seeded, so two
+// builds of the same code give the same sequence.
+// ----------------------------------------------------------------------------
+
+// Functions in the synthetic program. Three callees out of four are among
+// the first REPLAY_HOT_FUNCTIONS
+#define REPLAY_FUNCTIONS 1024
+#define REPLAY_HOT_FUNCTIONS 64
+
+// Cycles from sending a request to the L2 to its fill
+#define REPLAY_FILL_LATENCY 20
+
+// One prefetch the code handed to the L1I
+struct REPLAY_PF {
+  uint64_t cycle;
+  uint64_t addr;
+  int unit;                                   // hybrid member, 0 for a member alone
+  int level;                                  // PPF level, -1 without one
+  int accepted;
+};
+static vector<REPLAY_PF> replay_seq;
+
+class O3_CPU;
+
+// ----------------------------------------------------------------------------
+// L1I_SET x L1I_WAY LRU cache with a PQ of L1I_PQ_SIZE that sends one
+// prefetch per cycle. Only what the members and hybrids read of ChampSim's
+// L1I is provided
+// ----------------------------------------------------------------------------
+class REPLAY_L1I {
+  public:
+    struct LINE {
+      bool valid = false;
+      bool prefetch = false;                  // filled by a prefetch, not used yet
+      uint64_t block = 0;
+      uint64_t lru = 0;
+      long source_ent = -1;
+    };
+
+    struct REQUEST {
+      uint64_t block;
+      uint64_t ready;
+      uint64_t timestamp;
+      long source_ent;
+      bool demanded;
+    };
+
+    LINE lines[L1I_SET][L1I_WAY];
+    deque<REQUEST> pq;
+    vector<REQUEST> inflight;
+    uint64_t lru_clock = 0;
+
+    uint32_t get_size(uint8_t queue_type, uint64_t address){ return queue_type == 3 ? L1I_PQ_SIZE : 0; }
+    uint32_t get_occupancy(uint8_t queue_type, uint64_t address){ return queue_type == 3 ? pq.size() : 0; }
+
+    bool ongoing_request_vaddr(uint64_t v_addr){
+      uint64_t block = v_addr >> LOG2_BLOCK_SIZE;
+      for(auto &r : pq)
+        if(r.block == block)
+          return true;
+      return find_inflight(block) != NULL;
+    }
+
+    LINE *find(uint64_t block){
+      for(uint32_t w = 0; w < L1I_WAY; w++){
+        LINE &l = lines[block % L1I_SET][w];
+        if(l.valid && l.block == block)
+          return &l;
+      }
+      return NULL;
+    }
+
+    REQUEST *find_inflight(uint64_t block){
+      for(auto &r : inflight)
+        if(r.block == block)
+          return &r;
+      return NULL;
+    }
+
+    // A demand access, returns true on a hit
+    bool demand(uint64_t block, uint64_t cycle, bool &prefetch_hit){
+      LINE *l = find(block);
+      prefetch_hit = false;
+      if(l != NULL){
+        prefetch_hit = l->prefetch;
+        l->prefetch = false;
+        l->lru = ++lru_clock;
+        return true;
+      }
+      //A prefetch already on its way becomes late
+      if(REQUEST *r = find_inflight(block)){
+        if(!r->demanded){
+          r->demanded = true;
+          r->timestamp = cycle;
+        }
+      }else{
+        inflight.push_back({block, cycle + REPLAY_FILL_LATENCY, cycle, -1, true});
+      }
+      return false;
+    }
+
+    bool prefetch(uint64_t block, uint64_t cycle, long source_ent){
+      if(pq.size() >= L1I_PQ_SIZE)
+        return false;
+      pq.push_back({block, 0, cycle, source_ent, false});
+      return true;
+    }
+
+    // Sends the PQ's head and fills what arrived this cycle
+    void operate(O3_CPU &cpu, uint64_t cycle);
+
+  private:
+    void fill(O3_CPU &cpu, const REQUEST &r);
+};
+
+// ----------------------------------------------------------------------------
+// The hooks as ChampSim declares them, once under their own name and once per
+// hybrid member under the names the hybrids give them
+// ----------------------------------------------------------------------------
+#define REPLAY_HOOKS(N) \
+  void l1i_prefetcher_initialize##N(); \
+  void l1i_prefetcher_branch_operate##N(uint64_t ip, uint8_t branch_type, uint64_t branch_target); \
+  void l1i_prefetcher_cache_operate##N(uint64_t v_addr, uint8_t cache_hit, uint8_t prefetch_hit); \
+  void l1i_prefetcher_cycle_operate##N(); \
+  void l1i_prefetcher_cache_fill##N(uint64_t v_addr, uint32_t set, uint32_t way, uint8_t prefetch, \
+      uint64_t evicted_v_addr, PACKET &filling_entry, BLOCK &evicting_entry); \
+  void l1i_prefetcher_final_stats##N(); \
+  int prefetch_code_line##N(uint64_t pf_v_addr); \
+  int prefetch_code_line##N(uint64_t pf_v_addr, long source_ent);
+
+class O3_CPU {
+  public:
+    uint32_t cpu = 0;
+    REPLAY_L1I L1I;
+
+    REPLAY_HOOKS()
+    REPLAY_HOOKS(1)
+    REPLAY_HOOKS(2)
+    REPLAY_HOOKS(3)
+    REPLAY_HOOKS(4)
+
+    // What the hybrids issue through
+    int prefetch_code_line(uint64_t pf_v_addr, uint32_t pf_unit, uint64_t timestamp, long source_ent);
+    int prefetch_code_line(uint64_t pf_v_addr, uint32_t pf_unit, int level, uint64_t timestamp, long source_ent);
+};
+
+// What main.cc and ooo_cpu.cc would define
+uint64_t current_core_cycle[NUM_CPUS];
+uint8_t all_warmup_complete = 0;
+vector<O3_CPU> ooo_cpu(NUM_CPUS);
+
+// Defined here for a member alone, by the hybrid otherwise
+void l1i_shadow_probe(uint64_t addr, bool *hit, bool *pre);
+
+#ifdef REPLAY_MEMBER
+#include "pf_batch.h"
+void prefetch_code_lines(const PF_RECORD *records, uint32_t count);
+
+#include REPLAY_MEMBER
+
+// A member alone issues straight to the L1I, as in ChampSim
+int O3_CPU::prefetch_code_line(uint64_t pf_v_addr){
+  return prefetch_code_line(pf_v_addr, 0, current_core_cycle[cpu], -1);
+}
+
+int O3_CPU::prefetch_code_line(uint64_t pf_v_addr, long source_ent){
+  return prefetch_code_line(pf_v_addr, 0, current_core_cycle[cpu], source_ent);
+}
+
+void prefetch_code_lines(const PF_RECORD *records, uint32_t count){
+  for(uint32_t a = 0; a < count; a++)
+    ooo_cpu[0].prefetch_code_line(records[a].pf_addr, records[a].source_ent);
+}
+
+void l1i_shadow_probe(uint64_t addr, bool *hit, bool *pre){
+  uint64_t block = addr >> LOG2_BLOCK_SIZE;
+  REPLAY_L1I &l1i = ooo_cpu[0].L1I;
+  if(hit)
+    *hit = l1i.find(block) != NULL;
+  if(pre)
+    *pre = l1i.ongoing_request_vaddr(addr);
+}
+#else
+#include REPLAY_HYBRID
+#endif
+
+int O3_CPU::prefetch_code_line(uint64_t pf_v_addr, uint32_t pf_unit, uint64_t timestamp, long source_ent){
+  return prefetch_code_line(pf_v_addr, pf_unit, -1, timestamp, source_ent);
+}
+
+//Only what the PPF sends to the L1I enters the model, the rest is recorded
+int O3_CPU::prefetch_code_line(uint64_t pf_v_addr, uint32_t pf_unit, int level, uint64_t timestamp, long source_ent){
+  uint64_t cycle = current_core_cycle[cpu];
+  int accepted = 1;
+  if(level < 0 || level == PF_L1)
+    accepted = L1I.prefetch(pf_v_addr >> LOG2_BLOCK_SIZE, cycle, source_ent);
+  replay_seq.push_back({cycle, pf_v_addr, (int)pf_unit, level, accepted});
+  return accepted;
+}
+
+void REPLAY_L1I::operate(O3_CPU &cpu, uint64_t cycle){
+  if(!pq.empty()){
+    REQUEST r = pq.front();
+    pq.pop_front();
+    if(find(r.block) == NULL && find_inflight(r.block) == NULL){
+      r.ready = cycle + REPLAY_FILL_LATENCY;
+      inflight.push_back(r);
+    }
+  }
+
+  uint32_t kept = 0;
+  for(uint32_t a = 0; a < inflight.size(); a++){
+    if(inflight[a].ready <= cycle)
+      fill(cpu, inflight[a]);
+    else
+      inflight[kept++] = inflight[a];
+  }
+  inflight.resize(kept);
+}
+
+void REPLAY_L1I::fill(O3_CPU &cpu, const REQUEST &r){
+  uint32_t set = r.block % L1I_SET;
+  uint32_t way = 0;
+  for(uint32_t w = 0; w < L1I_WAY; w++){
+    if(!lines[set][w].valid){
+      way = w;
+      break;
+    }
+    if(lines[set][w].lru < lines[set][way].lru)
+      way = w;
+  }
+
+  LINE &l = lines[set][way];
+  PACKET filling;
+  filling.demanded = r.demanded;
+  filling.timestamp = r.timestamp;
+  filling.source_ent = r.source_ent;
+  BLOCK evicting;
+  evicting.prefetch = l.valid && l.prefetch;
+  evicting.source_ent = l.valid ? l.source_ent : -1;
+  uint64_t evicted_v_addr = l.valid ? l.block << LOG2_BLOCK_SIZE : 0;
+
+  l.valid = true;
+  l.prefetch = !r.demanded;
+  l.block = r.block;
+  l.lru = ++lru_clock;
+  l.source_ent = r.source_ent;
+  cpu.l1i_prefetcher_cache_fill(r.block << LOG2_BLOCK_SIZE, set, way, !r.demanded, evicted_v_addr, filling, evicting);
+}
+
+// ----------------------------------------------------------------------------
+// Random walk through a program of functions made of basic blocks laid out
+// back to back. A block ends in a call, a conditional branch or nothing; its
+// callees, branch target and taken rate are fixed when the program is made,
+// only the outcomes are drawn during the walk. An indirect call picks one of
+// REPLAY_CALLEES functions. When the outermost function returns the walk
+// jumps to another one
+// ----------------------------------------------------------------------------
+#define REPLAY_CALLEES 4
+#define REPLAY_MAX_DEPTH 32
+
+struct REPLAY_INSTR {
+  uint64_t ip;
+  uint8_t branch_type;                        // 0 unless the instruction is a branch
+  uint64_t branch_target;                     // 0 for a branch not taken
+};
+
+class REPLAY_PROGRAM {
+  public:
+    REPLAY_PROGRAM(uint64_t seed) : rng(seed | 1), func(0), bb(0), instr(0){
+      uint64_t addr = 0x400000;
+      funcs.resize(REPLAY_FUNCTIONS);
+      for(auto &f : funcs){
+        uint32_t bbs = 2 + xorshift(rng) % 12;
+        for(uint32_t b = 0; b < bbs; b++){
+          BB blk = {addr, 1 + (uint32_t)(xorshift(rng) % 16), 0, 0, 0, {0}};
+          uint32_t r = xorshift(rng) % 100;
+          if(r < 15){
+            blk.branch_type = r < 4 ? BRANCH_INDIRECT_CALL : BRANCH_DIRECT_CALL;
+            for(uint32_t c = 0; c < REPLAY_CALLEES; c++)
+              blk.callees[c] = pick();
+          }else if(r < 45){
+            blk.branch_type = BRANCH_CONDITIONAL;
+            blk.target = xorshift(rng) % bbs;
+            blk.taken_pct = 10 + xorshift(rng) % 81;
+          }
+          f.push_back(blk);
+          addr += 4 * blk.len;
+        }
+        addr = (addr + 15 + (xorshift(rng) % 256)) & ~15ull;
+      }
+    }
+
+    REPLAY_INSTR next(){
+      const BB &cur = funcs[func][bb];
+      REPLAY_INSTR in = {cur.start + 4 * instr, 0, 0};
+      if(++instr < cur.len)
+        return in;
+      instr = 0;
+
+      if(bb + 1 == funcs[func].size()){
+        if(!stack.empty()){
+          in.branch_type = BRANCH_RETURN;
+          func = stack.back().first;
+          bb = stack.back().second;
+          stack.pop_back();
+        }else{
+          in.branch_type = BRANCH_DIRECT_JUMP;
+          func = pick();
+          bb = 0;
+        }
+      }else if(cur.branch_type == BRANCH_CONDITIONAL){
+        in.branch_type = BRANCH_CONDITIONAL;
+        if(xorshift(rng) % 100 >= cur.taken_pct){
+          bb++;
+          return in;
+        }
+        bb = cur.target;
+      }else if(cur.branch_type != 0 && stack.size() < REPLAY_MAX_DEPTH){
+        in.branch_type = cur.branch_type;
+        stack.push_back({func, bb + 1});
+        func = cur.branch_type == BRANCH_INDIRECT_CALL ? cur.callees[xorshift(rng) % REPLAY_CALLEES] : cur.callees[0];
+        bb = 0;
+      }else{
+        bb++;
+        return in;
+      }
+      in.branch_target = funcs[func][bb].start;
+      return in;
+    }
+
+  private:
+    struct BB {
+      uint64_t start;
+      uint32_t len;
+      uint8_t branch_type;                    // BRANCH_CONDITIONAL, a call or 0
+      uint32_t target;                        // block a conditional branch goes to
+      uint32_t taken_pct;
+      uint32_t callees[REPLAY_CALLEES];       // only the first for a direct call
+    };
+    vector<vector<BB>> funcs;
+    vector<pair<uint32_t, uint32_t>> stack;
+    uint64_t rng;
+    uint32_t func, bb, instr;
+
+    uint32_t pick(){
+      return xorshift(rng) % 4 ? xorshift(rng) % REPLAY_HOT_FUNCTIONS : xorshift(rng) % REPLAY_FUNCTIONS;
+    }
+};
+
+// ----------------------------------------------------------------------------
+// One L1I access per cycle at most, a miss stalls the fetch until its fill.
+// The first quarter of the accesses is warmup
+// ----------------------------------------------------------------------------
+static void replay_run(uint64_t accesses, uint64_t seed){
+  O3_CPU &cpu = ooo_cpu[0];
+  REPLAY_PROGRAM program(seed);
+  cpu.l1i_prefetcher_initialize();
+
+  REPLAY_INSTR in = program.next();
+  uint64_t last_block = ~0ull, stall_block = ~0ull;
+  uint64_t accessed = 0;
+  for(uint64_t cycle = 1; accessed < accesses; cycle++){
+    current_core_cycle[cpu.cpu] = cycle;
+    cpu.L1I.operate(cpu, cycle);
+
+    if(stall_block != ~0ull && cpu.L1I.find_inflight(stall_block) == NULL)
+      stall_block = ~0ull;
+    bool accessed_now = false;
+    while(stall_block == ~0ull){
+      uint64_t block = in.ip >> LOG2_BLOCK_SIZE;
+      if(block != last_block){
+        if(accessed_now)
+          break;
+        bool prefetch_hit;
+        bool hit = cpu.L1I.demand(block, cycle, prefetch_hit);
+        cpu.l1i_prefetcher_cache_operate(in.ip, hit, prefetch_hit);
+        last_block = block;
+        accessed_now = true;
+        if(++accessed == accesses / 4)
+          all_warmup_complete = NUM_CPUS + 1;
+        if(!hit){
+          stall_block = block;
+          break;
+        }
+      }
+      if(in.branch_type)
+        cpu.l1i_prefetcher_branch_operate(in.ip, in.branch_type, in.branch_target);
+      in = program.next();
+    }
+
+    cpu.l1i_prefetcher_cycle_operate();
+  }
+}
+
+static bool save_seq(const char *path){
+  FILE *f = fopen(path, "w");
+  if(f == NULL){
+    printf("Could not open %s\n", path);
+    return false;
+  }
+  for(auto &p : replay_seq)
+    fprintf(f, "%lu %lx %d %d %d\n", p.cycle, p.addr, p.unit, p.level, p.accepted);
+  fclose(f);
+  return true;
+}
+
+// Returns 0 if the recorded sequence matches the one in path, 1 otherwise
+static int compare_seq(const char *path){
+  FILE *f = fopen(path, "r");
+  if(f == NULL){
+    printf("Could not open %s\n", path);
+    return 2;
+  }
+  REPLAY_PF p;
+  unsigned long cycle, addr;
+  size_t n = 0;
+  int rc = 0;
+  while(fscanf(f, "%lu %lx %d %d %d", &cycle, &addr, &p.unit, &p.level, &p.accepted) == 5){
+    p.cycle = cycle;
+    p.addr = addr;
+    if(n >= replay_seq.size()){
+      printf("Replay: %s has more than the %lu prefetches recorded\n", path, replay_seq.size());
+      rc = 1;
+      break;
+    }
+    const REPLAY_PF &q = replay_seq[n];
+    if(p.cycle != q.cycle || p.addr != q.addr || p.unit != q.unit || p.level != q.level || p.accepted != q.accepted){
+      printf("Replay: prefetch %lu differs, %lu %lx %d %d %d in %s, now %lu %lx %d %d %d\n", n, p.cycle, p.addr,
+          p.unit, p.level, p.accepted, path, q.cycle, q.addr, q.unit, q.level, q.accepted);
+      rc = 1;
+      break;
+    }
+    n++;
+  }
+  fclose(f);
+  if(rc == 0 && n < replay_seq.size()){
+    printf("Replay: %s has %lu of the %lu prefetches recorded\n", path, n, replay_seq.size());
+    rc = 1;
+  }
+  if(rc == 0)
+    printf("Replay: all %lu prefetches match %s\n", n, path);
+  return rc;
+}
+
+static int replay_main(uint64_t accesses, uint64_t seed, const char *save, const char *compare){
+  replay_run(accesses, seed);
+  printf("Replay: %lu L1I accesses, %lu prefetches, seed %lu\n", accesses, replay_seq.size(), seed);
+  if(save != NULL && !save_seq(save))
+    return 2;
+  return compare != NULL ? compare_seq(compare) : 0;
+}
+#endif
+
+int main(int argc, char **argv){
+  uint64_t ops = 1000000;
+  int reps = 5;
+  double tolerance = 10.0;
+  string stream = "";
+  string filter = "";
+  const char *save = NULL;
+  const char *baseline = NULL;
+  bool replay = false;
+  uint64_t seed = 1;
+  const char *save_seq_path = NULL;
+  const char *compare_seq_path = NULL;
+
+  for(int a = 1; a < argc; a++){
+    string arg = argv[a];
+    bool has_val = a + 1 < argc;
+    if(arg == "--ops" && has_val)
+      ops = strtoull(argv[++a], NULL, 10);
+    else if(arg == "--reps" && has_val)
+      reps = atoi(argv[++a]);
+    else if(arg == "--stream" && has_val)
+      stream = argv[++a];
+    else if(arg == "--filter" && has_val)
+      filter = argv[++a];
+    else if(arg == "--save" && has_val)
+      save = argv[++a];
+    else if(arg == "--baseline" && has_val)
+      baseline = argv[++a];
+    else if(arg == "--tolerance" && has_val)
+      tolerance = atof(argv[++a]);
+    else if(arg == "--pf-replay")
+      replay = true;
+    else if(arg == "--seed" && has_val)
+      seed = strtoull(argv[++a], NULL, 10);
+    else if(arg == "--save-seq" && has_val)
+      save_seq_path = argv[++a];
+    else if(arg == "--compare-seq" && has_val)
+      compare_seq_path = argv[++a];
+    else{
+      printf("Unknown argument %s\n", arg.c_str());
+      return 2;
+    }
+  }
+  assert(ops > 0 && reps > 0);
+
+  if(replay){
+#ifdef REPLAY
+    return replay_main(ops, seed, save_seq_path, compare_seq_path);
+#else
+    printf("Built without REPLAY_MEMBER or REPLAY_HYBRID, see the top of this file\n");
+    return 2;
+#endif
+  }
+
+  vector<string> streams;
+  if(stream.empty())
+    streams = {"seq", "loop", "random"};
+  else
+    streams.push_back(stream);
+
+  vector<BENCH_RESULT> results;
+  for(auto &s : streams){
+    vector<uint64_t> addrs = make_stream(s, ops);
+    if(filter.empty() || string("pfb").find(filter) != string::npos)
+      results.push_back(measure<BENCH_PFB>("pfb", s, addrs, reps));
+    if(filter.empty() || string("ppf_check").find(filter) != string::npos)
+      results.push_back(measure<BENCH_PPF_CHECK<BENCH_DYNAMIC_PPF>>("ppf_check", s, addrs, reps));
+    if(filter.empty() || string("ppf_update").find(filter) != string::npos)
+      results.push_back(measure<BENCH_PPF_UPDATE<BENCH_DYNAMIC_PPF>>("ppf_update", s, addrs, reps));
+    if(filter.empty() || string("sppf_check").find(filter) != string::npos)
+      results.push_back(measure<BENCH_PPF_CHECK<BENCH_STATIC_PPF>>("sppf_check", s, addrs, reps));
+    if(filter.empty() || string("sppf_update").find(filter) != string::npos)
+      results.push_back(measure<BENCH_PPF_UPDATE<BENCH_STATIC_PPF>>("sppf_update", s, addrs, reps));
+    if(filter.empty() || string("sppf_score").find(filter) != string::npos)
+      results.push_back(measure<BENCH_SPPF_SCORE>("sppf_score", s, addrs, reps));
+    if(filter.empty() || string("sampler").find(filter) != string::npos)
+      results.push_back(measure<BENCH_SAMPLER>("sampler", s, addrs, reps));
+  }
+
+  printf("%-12s %-16s %12s %12s\n", "benchmark", "stream", "ns/op", "allocs/op");
+  for(auto &r : results)
+    printf("%-12s %-16s %12.2f %12.2f\n", r.name.c_str(), r.stream.c_str(), r.ns_per_op, r.allocs_per_op);
+
+  if(save != NULL){
+    FILE *f = fopen(save, "w");
+    if(f == NULL){
+      printf("Could not open %s\n", save);
+      return 2;
+    }
+    for(auto &r : results)
+      fprintf(f, "%s %s %.4f %.4f\n", r.name.c_str(), r.stream.c_str(), r.ns_per_op, r.allocs_per_op);
+    fclose(f);
+  }
+
+  int rc = 0;
+  if(baseline != NULL){
+    map<string, BENCH_RESULT> base = load_results(baseline);
+    for(auto &r : results){
+      auto it = base.find(r.name + " " + r.stream);
+      if(it == base.end())
+        continue;
+      double limit = it->second.ns_per_op * (1.0 + tolerance / 100.0);
+      if(r.ns_per_op > limit){
+        printf("REGRESSION %s %s: %.2f ns/op, baseline %.2f\n", r.name.c_str(), r.stream.c_str(),
+          r.ns_per_op, it->second.ns_per_op);
+        rc = 1;
+      }
+      if(r.allocs_per_op > it->second.allocs_per_op + 0.01){
+        printf("REGRESSION %s %s: %.2f allocs/op, baseline %.2f\n", r.name.c_str(), r.stream.c_str(),
+          r.allocs_per_op, it->second.allocs_per_op);
+        rc = 1;
+      }
+    }
+  }
+  return rc;
+}
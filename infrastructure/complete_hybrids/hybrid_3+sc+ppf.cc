@@ -3,9 +3,20 @@
 #include "shadow_cache.h"
 #include "set_sampler.h"
 #include "ppf.h"
+#include "static_ppf.h"
+#include "stats_registry.h"
+#include "epoch_telemetry.h"
+#include "checkpoint.h"
+#include "hybrid_config.h"
+#include "ppf_tuner.h"
+#include "priority_prefetch_buffer.h"
+#include "pf_batch.h"
+#include "pf_timeliness.h"
+#include <algorithm>
 #include <iostream>
 #include <list>
 #include <map>
+#include <climits>
 #include <cstdlib>
 
 #define HYBRID_BOP
@@ -21,6 +32,51 @@
 //Enable/disable shadow cache during prefetch generation
 #define PFB_SHADOWCACHE_ENABLED 0
 
+//Splits the free L1I PQ slots over the members by the utility their samplers
+//measured in the last telemetry epochs instead of round-robin, slots a member
+//cannot use go to the others. See allocate_prefetches in prefetch_buffer.cc.
+//Needs MEASURE
+#define UTILITY_ALLOC 0
+
+//Issues the blocks the most members buffered first instead of round-robin,
+//each once with pref_overlap_id naming all its voters. Blocks fewer than
+//VOTE_QUORUM members buffered are dropped when voted on, so a quorum of 2
+//issues only what the members agree on. See vote_prefetches in
+//prefetch_buffer.cc. Not used with PRIORITY_PFB
+#define VOTERS 0
+#define VOTE_QUORUM 1
+
+//Buffers all members' candidates in one heap drained by confidence and
+//deadline instead of per-member FIFOs, see priority_prefetch_buffer.h. The
+//confidence is the member's utility from the last telemetry epoch, a
+//candidate is dropped PRIORITY_PFB_WINDOW cycles after it was generated and
+//one unit of confidence outranks PRIORITY_PFB_CONF_CYCLES cycles of age
+#define PRIORITY_PFB 0
+#define PRIORITY_PFB_WINDOW 2000
+#define PRIORITY_PFB_CONF_CYCLES 1000
+
+//Drops the blocks a member repeats within its batch of candidates before the
+//batch goes into the prefetch buffer, so they do not take two entries
+#define PF_BATCH_DEDUP 0
+
+//Keeps the prefetches the L1I PQ refuses in a retry queue of PF_RETRY_SIZE
+//entries, issued ahead of new ones and dropped PF_RETRY_WINDOW cycles after
+//they were refused. While the PQ stays full (under one free slot on average
+//over recent cycles) a full member buffer also replaces its oldest entry with
+//the new candidate instead of dropping it. The lost candidates are counted
+//per member and reason under pfb.drops either way
+#define ISSUE_PIPELINE 0
+#define PF_RETRY_SIZE 16
+#define PF_RETRY_WINDOW 200
+
+//Schedules by timeliness, from the lead times measured for each member (see
+//pf_timeliness.h). A candidate older than TIMELY_LEAD_FACTOR times its
+//member's average lead time has most likely been demanded already and is
+//dropped, and the member whose oldest candidate is due first goes first.
+//With PRIORITY_PFB that age becomes the entry's deadline instead
+#define TIMELY_PFB 0
+#define TIMELY_LEAD_FACTOR 2.0
+
 //PPF SETTINGS
 //Enables PPF                                                  
 #define PPF_ENABLED 0
@@ -28,6 +84,13 @@
 #define PPF_MERGE 0 
 //Allows PPF to prefetch directly to the L1, L2, or reject a prefetch completely
 #define PPF_MULTI_LEVEL 1
+//Use the compile-time specialized PPF in static_ppf.h instead of ppf.cc's.
+//Same decisions, the feature sets are chosen below
+#define STATIC_PPF_ENABLED
+//One PPF for all members instead of one each: the member is a feature, the
+//tracking tables are shared and each member keeps its thresholds. Needs
+//STATIC_PPF_ENABLED
+#define SHARED_PPF 0
 
 //Size of the bit vectors containing branch behavior history 
 #define B_HIST_LENGTH 32
@@ -38,6 +101,52 @@
 //Turns on feedback metrics for PFB
 //#define PFB_METRICS
 
+//Machine-readable stats, see stats_registry.h. An empty file name disables
+//the output. HYBRID_STATS_FILE, HYBRID_STATS_FORMAT and HYBRID_STATS_EPOCH
+//override these at runtime
+#define STATS_FILE ""
+#define STATS_FILE_FORMAT STATS_JSON
+//Number of L1I accesses between per-epoch snapshots, 0 dumps only at the end
+#define STATS_EPOCH 0
+
+//Per-epoch time series of the members' sampled coverage, accuracy and
+//harmfulness, queue pressure and PPF decisions, see epoch_telemetry.h.
+//HYBRID_TELEMETRY_FILE overrides the file name, empty keeps it in memory
+#define TELEMETRY_FILE ""
+//Number of L1I accesses per telemetry epoch, epoch_size in the runtime
+//config overrides it
+#define TELEMETRY_EPOCH EPOCH_SIZE
+
+//Hill climbs each member's PPF thresholds on the L1I miss rate, one move per
+//telemetry epoch, starting from the thresholds set in initialize, see
+//ppf_tuner.h. Only with PPF_ENABLED. HYBRID_TUNER_LOG overrides the file the
+//trajectory is written to, empty writes none
+#define PPF_TUNER_ENABLED 0
+#define PPF_TUNER_STEP 64
+#define PPF_TUNER_MIN_STEP 8
+#define PPF_TUNER_BOUND 1024
+#define PPF_TUNER_LOG ""
+
+//Warm-start of the PPF weights and the members' tables, see checkpoint.h.
+//The state is saved once warmup completes and loaded at initialization.
+//HYBRID_CHECKPOINT_SAVE and HYBRID_CHECKPOINT_LOAD override these, empty
+//disables either
+#define CHECKPOINT_SAVE ""
+#define CHECKPOINT_LOAD ""
+
+//Reads the filtering switches above, the PPF parameters and the prefetch
+//buffer sizes from the "hybrid" section of a JSON file at initialization,
+//see hybrid_config.h, so a sweep needs one build. HYBRID_CONFIG overrides the
+//file name, empty keeps the defaults. With RUNTIME_CONFIG 0 the switches are
+//constants again
+#define RUNTIME_CONFIG 1
+#define HYBRID_CONFIG_FILE ""
+
+//Times each hybrid stage per member and reports it with the final stats,
+//see hybrid_profile.h. Has to come before the include below
+//#define HYBRID_PROFILE
+#include "hybrid_profile.h"
+
 using namespace std;
 
 
@@ -46,11 +155,123 @@ using namespace std;
 // Three prefetchers + shadow cache
 const uint32_t num_prefetchers = 3;
 
-// An array of three lists, one for each prefetcher
-list<uint64_t> my_prefetch_queue[num_prefetchers];
-list<long> my_prefetch_queue_source_ent[num_prefetchers];
+// One batch of candidates for each prefetcher, drained every cycle
+PF_BATCH my_prefetch_queue[num_prefetchers];
+// Repeated blocks dropped from the batches with pf_batch_dedup
+uint64_t batch_duplicates[num_prefetchers];
+// Set when a member hands over a candidate and kept while the buffer holds
+// entries. Without it cycle_operate has nothing to drain or issue
+bool pf_work_pending = false;
 
 PREFETCH_BUFFER pfb(num_prefetchers);
+PRIORITY_PREFETCH_BUFFER ppfb;
+
+// Every component registers its counters here during initialization
+STATS_REGISTRY stats;
+
+// Per-epoch counters, closed every TELEMETRY_EPOCH L1I accesses
+EPOCH_TELEMETRY telemetry;
+
+// Predictor state saved at the end of warmup
+HYBRID_CHECKPOINT checkpoint;
+extern uint8_t all_warmup_complete;
+
+// The filtering switches, fixed for the whole run once initialized
+HYBRID_CONFIG hybrid_config;
+#if RUNTIME_CONFIG
+bool ppf_enabled = PPF_ENABLED;
+bool ppf_merge = PPF_MERGE;
+bool ppf_multi_level = PPF_MULTI_LEVEL;
+bool pfb_shadowcache_enabled = PFB_SHADOWCACHE_ENABLED;
+bool ppf_tuner_enabled = PPF_TUNER_ENABLED;
+bool priority_pfb = PRIORITY_PFB;
+uint64_t priority_pfb_window = PRIORITY_PFB_WINDOW;
+bool pf_batch_dedup = PF_BATCH_DEDUP;
+bool issue_pipeline = ISSUE_PIPELINE;
+uint64_t pf_retry_window = PF_RETRY_WINDOW;
+bool timely_pfb = TIMELY_PFB;
+float timely_lead_factor = TIMELY_LEAD_FACTOR;
+#else
+const bool ppf_enabled = PPF_ENABLED;
+const bool ppf_merge = PPF_MERGE;
+const bool ppf_multi_level = PPF_MULTI_LEVEL;
+const bool pfb_shadowcache_enabled = PFB_SHADOWCACHE_ENABLED;
+const bool ppf_tuner_enabled = PPF_TUNER_ENABLED && PPF_ENABLED;
+const bool priority_pfb = PRIORITY_PFB;
+const uint64_t priority_pfb_window = PRIORITY_PFB_WINDOW;
+const bool pf_batch_dedup = PF_BATCH_DEDUP;
+const bool issue_pipeline = ISSUE_PIPELINE;
+const uint64_t pf_retry_window = PF_RETRY_WINDOW;
+const bool timely_pfb = TIMELY_PFB;
+const float timely_lead_factor = TIMELY_LEAD_FACTOR;
+#endif
+// Defined in prefetch_buffer.cc
+extern uint32_t pf_buff_size;
+extern uint64_t pf_epoch_size;
+extern bool pf_utility_alloc;
+extern float pf_slot_weight[];
+extern bool pf_voters;
+extern uint32_t pf_vote_quorum;
+extern uint64_t pf_vote_issued[];
+extern uint64_t pf_vote_rejected;
+extern bool pf_replace_oldest;
+extern uint64_t pf_full_drops[];
+extern uint64_t pf_aged_out[];
+extern uint64_t pf_redundant_drops[];
+extern bool pf_timely;
+extern uint64_t pf_timely_now;
+extern uint64_t pf_timely_window[];
+extern uint64_t pf_timely_lead[];
+extern uint64_t pf_late_drops[];
+
+// Prefetches the PQ refused, oldest first, with the level the PPF chose (-1
+// without PPF_MULTI_LEVEL) and the cycle they were refused
+struct PF_RETRY {
+  PF_BUFFER_ENTRY pf;
+  int level;
+  uint64_t cycle;
+};
+deque<PF_RETRY> retry_queue;
+// Free PQ slots averaged over recent cycles, in 1/16 slots
+uint32_t pq_free_avg = 0;
+// Set when something reads the PQ pressure of idle cycles: the telemetry
+// file, the structured stats or the issue pipeline's trend. Otherwise an idle
+// cycle does not look at the PQ
+bool sample_idle_pq = false;
+// Per member: refused by the PQ and lost, issued from the retry queue, and
+// dropped from it too old or to make room
+uint64_t pq_refused[num_prefetchers];
+uint64_t retried[num_prefetchers];
+uint64_t retry_expired[num_prefetchers];
+uint64_t retry_overflow[num_prefetchers];
+
+// Lead time and lateness of each member's prefetches
+PF_TIMELINESS timeliness;
+
+// Moves the PPF thresholds at telemetry epochs when ppf_tuner_enabled
+PPF_TUNER tuner;
+
+// Probes the hybrid's shadow cache, which sees the demand accesses and every
+// member's issued prefetches, so a member can skip lines already in the L1I
+// without a model of its own. Defined below with sc
+void l1i_shadow_probe(uint64_t addr, bool *hit, bool *pre);
+
+// Batch counterparts of prefetch_code_line: a member hands over all the
+// candidates of one call as a span of records, see pf_batch.h
+void prefetch_code_lines1(const PF_RECORD *records, uint32_t count){
+  my_prefetch_queue[0].append(records, count);
+  pf_work_pending = true;
+}
+
+void prefetch_code_lines2(const PF_RECORD *records, uint32_t count){
+  my_prefetch_queue[1].append(records, count);
+  pf_work_pending = true;
+}
+
+void prefetch_code_lines3(const PF_RECORD *records, uint32_t count){
+  my_prefetch_queue[2].append(records, count);
+  pf_work_pending = true;
+}
 
 
 // First Prefetcher: \#defines help create individually named 
@@ -61,7 +282,10 @@ PREFETCH_BUFFER pfb(num_prefetchers);
 #define l1i_prefetcher_cycle_operate l1i_prefetcher_cycle_operate1
 #define l1i_prefetcher_final_stats l1i_prefetcher_final_stats1
 #define l1i_prefetcher_initialize l1i_prefetcher_initialize1
+#define l1i_prefetcher_register_stats l1i_prefetcher_register_stats1
+#define l1i_prefetcher_register_checkpoint l1i_prefetcher_register_checkpoint1
 #define prefetch_code_line prefetch_code_line1
+#define prefetch_code_lines prefetch_code_lines1
 #define l1i_prefetcher_id 0
 
 #include XXX 
@@ -72,9 +296,21 @@ PREFETCH_BUFFER pfb(num_prefetchers);
 #undef l1i_prefetcher_cycle_operate
 #undef l1i_prefetcher_final_stats
 #undef l1i_prefetcher_initialize
+#undef l1i_prefetcher_register_stats
+#undef l1i_prefetcher_register_checkpoint
 #undef prefetch_code_line
+#undef prefetch_code_lines
 #undef l1i_prefetcher_id
 
+//A member whose cycle_operate does nothing defines L1I_NO_CYCLE_HOOK, the
+//hybrid then skips the call
+#ifdef L1I_NO_CYCLE_HOOK
+#define MEMBER1_CYCLE_HOOK 0
+#undef L1I_NO_CYCLE_HOOK
+#else
+#define MEMBER1_CYCLE_HOOK 1
+#endif
+
 // Second Prefetcher: \#defines help create individually named 
 // functions for each prefetcher
 #define l1i_prefetcher_branch_operate l1i_prefetcher_branch_operate2
@@ -83,7 +319,10 @@ PREFETCH_BUFFER pfb(num_prefetchers);
 #define l1i_prefetcher_cycle_operate l1i_prefetcher_cycle_operate2
 #define l1i_prefetcher_final_stats l1i_prefetcher_final_stats2
 #define l1i_prefetcher_initialize l1i_prefetcher_initialize2
+#define l1i_prefetcher_register_stats l1i_prefetcher_register_stats2
+#define l1i_prefetcher_register_checkpoint l1i_prefetcher_register_checkpoint2
 #define prefetch_code_line prefetch_code_line2
+#define prefetch_code_lines prefetch_code_lines2
 #define l1i_prefetcher_id 1
 
 #include YYY 
@@ -94,9 +333,21 @@ PREFETCH_BUFFER pfb(num_prefetchers);
 #undef l1i_prefetcher_cycle_operate
 #undef l1i_prefetcher_final_stats
 #undef l1i_prefetcher_initialize
+#undef l1i_prefetcher_register_stats
+#undef l1i_prefetcher_register_checkpoint
 #undef prefetch_code_line
+#undef prefetch_code_lines
 #undef l1i_prefetcher_id
 
+//A member whose cycle_operate does nothing defines L1I_NO_CYCLE_HOOK, the
+//hybrid then skips the call
+#ifdef L1I_NO_CYCLE_HOOK
+#define MEMBER2_CYCLE_HOOK 0
+#undef L1I_NO_CYCLE_HOOK
+#else
+#define MEMBER2_CYCLE_HOOK 1
+#endif
+
 // Third Prefetcher: \#defines help create individually named 
 // functions for each prefetcher
 #define l1i_prefetcher_branch_operate l1i_prefetcher_branch_operate3
@@ -105,7 +356,10 @@ PREFETCH_BUFFER pfb(num_prefetchers);
 #define l1i_prefetcher_cycle_operate l1i_prefetcher_cycle_operate3
 #define l1i_prefetcher_final_stats l1i_prefetcher_final_stats3
 #define l1i_prefetcher_initialize l1i_prefetcher_initialize3
+#define l1i_prefetcher_register_stats l1i_prefetcher_register_stats3
+#define l1i_prefetcher_register_checkpoint l1i_prefetcher_register_checkpoint3
 #define prefetch_code_line prefetch_code_line3
+#define prefetch_code_lines prefetch_code_lines3
 #define l1i_prefetcher_id 2
 
 #include "ISCA_Entangling_1Ke_NoShadows.inc"
@@ -116,23 +370,62 @@ PREFETCH_BUFFER pfb(num_prefetchers);
 #undef l1i_prefetcher_cycle_operate
 #undef l1i_prefetcher_final_stats
 #undef l1i_prefetcher_initialize
+#undef l1i_prefetcher_register_stats
+#undef l1i_prefetcher_register_checkpoint
 #undef prefetch_code_line
+#undef prefetch_code_lines
 #undef l1i_prefetcher_id
 
-PPF ppf1;
-PPF ppf2;
-PPF ppf3;
+//A member whose cycle_operate does nothing defines L1I_NO_CYCLE_HOOK, the
+//hybrid then skips the call
+#ifdef L1I_NO_CYCLE_HOOK
+#define MEMBER3_CYCLE_HOOK 0
+#undef L1I_NO_CYCLE_HOOK
+#else
+#define MEMBER3_CYCLE_HOOK 1
+#endif
+
+//Feature set of each member's PPF, see static_ppf.h
+typedef PPF_DEFAULT_FEATURES PPF1_FEATURES;
+typedef PPF_DEFAULT_FEATURES PPF2_FEATURES;
+typedef PPF_DEFAULT_FEATURES PPF3_FEATURES;
+
+//Shape of the PPFs' tracking tables, e.g. PPF_TRACKING<TRACKING_TABLE_SIZE, 4,
+//16, PPF_REPL_RRIP> for 4-way sets, 16-bit tags and SRRIP. The default is
+//ppf.cc's direct-mapped table
+typedef PPF_DEFAULT_TRACKING PPF_TRACKING_CONFIG;
+
+#if SHARED_PPF
+#ifndef STATIC_PPF_ENABLED
+#error "SHARED_PPF needs STATIC_PPF_ENABLED"
+#endif
+STATIC_PPF<PPF_SHARED_FEATURES, PPF_TRACKING_CONFIG> ppf_shared;
+#elif defined(STATIC_PPF_ENABLED)
+STATIC_PPF<PPF1_FEATURES, PPF_TRACKING_CONFIG> ppf1;
+STATIC_PPF<PPF2_FEATURES, PPF_TRACKING_CONFIG> ppf2;
+STATIC_PPF<PPF3_FEATURES, PPF_TRACKING_CONFIG> ppf3;
+#else
+PPF_ADAPTER<PPF1_FEATURES> ppf1;
+PPF_ADAPTER<PPF2_FEATURES> ppf2;
+PPF_ADAPTER<PPF3_FEATURES> ppf3;
+#endif
 
 uint64_t branch_history = 0;
 uint64_t b_taken_hist = 0;
 uint64_t b_type_hist = 0;
 uint64_t last_b_target = 0;
 uint64_t last_pf = 0;
+//Block of the last L1I access
+uint64_t ppf_last_ip = 0;
 
 // Elba: Made the shadow cache a class
 SHADOW_CACHE sc;
 SAMPLER base_sc;
 
+void l1i_shadow_probe(uint64_t addr, bool *hit, bool *pre){
+  sc.access_cache(addr, hit, pre, 0, NULL, NULL, ACCESS_PROBE);
+}
+
 #ifdef MEASURE
 
 SAMPLER sampler1;
@@ -169,9 +462,170 @@ vector<float> avg_entries_3;
 
 uint64_t num_acc = 0;
 
-uint64_t filtered_1 = 0;
-uint64_t filtered_2 = 0;
-uint64_t filtered_3 = 0;
+uint64_t filtered[num_prefetchers];
+
+// ----------------------------------------------------------------------------
+// Registers one PPF's counters and distributions under prefix
+// ----------------------------------------------------------------------------
+template<typename PPF_TYPE>
+void register_ppf_stats(PPF_TYPE &ppf, const string &prefix)
+{
+  stats.add_counter(prefix + "accept_table_hit", &ppf.accept_table_hit);
+  stats.add_counter(prefix + "reject_table_hit", &ppf.reject_table_hit);
+  stats.add_counter(prefix + "increment_weight", &ppf.increment_weight);
+  stats.add_counter(prefix + "decrement_weight", &ppf.decrement_weight);
+  stats.add_counter(prefix + "accept_trigger", &ppf.accept_trigger);
+  stats.add_counter(prefix + "reject_trigger", &ppf.reject_trigger);
+  stats.add_counter(prefix + "eviction_update", &ppf.eviction_update);
+  stats.add_counter(prefix + "sum_max", &ppf.sum_max);
+  stats.add_counter(prefix + "sum_min", &ppf.sum_min);
+  stats.add_function(prefix + "unique_indexes", [&ppf]() {
+    vector<uint64_t> unique;
+    for(int a = 0; a < ppf.NUM_FEAT; a++)
+      unique.push_back(ppf.unique_indexes[a].size());
+    return unique;
+  });
+  for(int a = 0; a < ppf.NUM_FEAT; a++)
+    stats.add_function(prefix + "weight_distro." + to_string(a), [&ppf, a]() { return ppf.get_feat_distro(a); });
+  stats.add_function(prefix + "sum_distro", [&ppf]() { return ppf.get_sum_distro(); });
+}
+
+// ----------------------------------------------------------------------------
+// Member puid's PPF decision on a candidate, only PF_L1 or PF_REJECT unless
+// multi_level
+// ----------------------------------------------------------------------------
+PF_LEVEL ppf_check(uint32_t puid, uint64_t pf_addr, const PPF_CONTEXT &ctx, bool multi_level)
+{
+#if SHARED_PPF
+  return multi_level ? ppf_shared.check_filter_level(pf_addr, ctx) : (ppf_shared.check_filter(pf_addr, ctx) ? PF_L1 : PF_REJECT);
+#else
+  switch(puid){
+    case 0:
+      return multi_level ? ppf1.check_filter_level(pf_addr, ctx) : (ppf1.check_filter(pf_addr, ctx) ? PF_L1 : PF_REJECT);
+    case 1:
+      return multi_level ? ppf2.check_filter_level(pf_addr, ctx) : (ppf2.check_filter(pf_addr, ctx) ? PF_L1 : PF_REJECT);
+    case 2:
+      return multi_level ? ppf3.check_filter_level(pf_addr, ctx) : (ppf3.check_filter(pf_addr, ctx) ? PF_L1 : PF_REJECT);
+  }
+  return PF_REJECT;
+#endif
+}
+
+// ----------------------------------------------------------------------------
+// Decision on a block several members requested: prefetched on the positive
+// outcome of any of their PPFs, at the best level any of them chose
+// ----------------------------------------------------------------------------
+PF_LEVEL ppf_merge_check(const PF_BUFFER_ENTRY &pf, const PPF_CONTEXT &ctx, bool multi_level)
+{
+  PF_LEVEL level = PF_REJECT;
+  for(uint32_t a = 0; a < num_prefetchers; a++){
+    if(!((pf.pref_overlap_id >> a) & 1))
+      continue;
+    PF_LEVEL member_level = ppf_check(a, pf.pf_addr, ctx, multi_level);
+    filtered[a] += member_level != PF_REJECT;
+    if(member_level == PF_L1 || (member_level == PF_L2 && level == PF_REJECT))
+      level = member_level;
+    //A shared PPF scores the candidate once for all of them
+    if(SHARED_PPF)
+      break;
+  }
+  return level;
+}
+
+// ----------------------------------------------------------------------------
+// The thresholds member puid's candidates are held to from now on. Its own
+// PPF also judges the blocks it shares with another member under PPF_MERGE,
+// whose puid the context carries, so all of that PPF's thresholds are set
+// ----------------------------------------------------------------------------
+void ppf_set_thresholds(uint32_t puid, int thresh, int l2_thresh)
+{
+#if SHARED_PPF
+  ppf_shared.set_unit_thresholds(puid, thresh, l2_thresh);
+#else
+  switch(puid){
+    case 0:
+      ppf1.set_thresholds(thresh, l2_thresh);
+      break;
+    case 1:
+      ppf2.set_thresholds(thresh, l2_thresh);
+      break;
+    case 2:
+      ppf3.set_thresholds(thresh, l2_thresh);
+      break;
+  }
+#endif
+}
+
+// ----------------------------------------------------------------------------
+// Member puid's PPF multi-level decisions on n candidates, see score_batch
+// ----------------------------------------------------------------------------
+void ppf_batch(uint32_t puid, const PPF_CONTEXT *ctx, uint32_t n, PF_LEVEL *levels)
+{
+#if SHARED_PPF
+  PROFILE_CALL(PROF_PPF, PROFILE_HYBRID, ppf_shared.score_batch(ctx, n, true, levels));
+#else
+  switch(puid){
+    case 0:
+      PROFILE_CALL(PROF_PPF, 0, ppf1.score_batch(ctx, n, true, levels));
+      break;
+    case 1:
+      PROFILE_CALL(PROF_PPF, 1, ppf2.score_batch(ctx, n, true, levels));
+      break;
+    case 2:
+      PROFILE_CALL(PROF_PPF, 2, ppf3.score_batch(ctx, n, true, levels));
+      break;
+  }
+#endif
+}
+
+// ----------------------------------------------------------------------------
+// Prints one PPF's counters, as final_stats always has
+// ----------------------------------------------------------------------------
+template<typename PPF_TYPE>
+void print_ppf_summary(PPF_TYPE &ppf, const char *name)
+{
+  printf("%s Accept %d %s Reject %d\n", 
+    name, ppf.accept_table_hit, name, ppf.reject_table_hit);
+  printf("%s Inc %d %s Dec %d\n", 
+    name, ppf.increment_weight, name, ppf.decrement_weight);
+  printf("%s Accept Trig %d Rej Trig %d\n", 
+    name, ppf.accept_trigger, ppf.reject_trigger);
+  printf("Eviction update %d\n", ppf.eviction_update);
+  for(int a = 0; a < ppf.NUM_FEAT; a++)
+    printf("%s Unique Indexes %d: %ld\n", name, a, ppf.unique_indexes[a].size());
+  printf("%s Maximum sum seen: %d Minimum sum seen: %d\n",
+    name, ppf.sum_max, ppf.sum_min);
+}
+
+// ----------------------------------------------------------------------------
+// Prints one PPF's weight distribution per feature and its sum distribution
+// ----------------------------------------------------------------------------
+template<typename PPF_TYPE>
+void print_ppf_distros(PPF_TYPE &ppf, const char *name)
+{
+  printf("%s Weight Distributions\n", name);
+  for(int a = 0; a < (ppf.MAX_FEAT * 2)/8; a++)
+    printf("%d:%d ", (-1 * ppf.MAX_FEAT) + (a * 8), (-1 * ppf.MAX_FEAT) + (a * 8) + 7);
+  printf("\n");
+  vector<uint64_t> weight_count;
+  for(int a = 0; a < ppf.NUM_FEAT; a++){
+    weight_count = ppf.get_feat_distro(a);
+    for(auto w : weight_count)
+      printf("%ld ", w);
+    printf("\n");
+  }
+
+  printf("%s Sum Distribution\n", name);
+  for(int a = 0; a < (ppf.MAX_FEAT * ppf.NUM_FEAT * 2)/ppf.MAX_FEAT; a++){
+    printf("%d:%d ", (-1 * ppf.MAX_FEAT * ppf.NUM_FEAT) + (a * ppf.MAX_FEAT), (-1 * ppf.MAX_FEAT * ppf.NUM_FEAT) + (a * ppf.MAX_FEAT) + ppf.MAX_FEAT - 1);
+  }
+  printf("\n");
+  vector<uint64_t> s_distro = ppf.get_sum_distro();
+  for(int a = 0; a < (ppf.MAX_FEAT * ppf.NUM_FEAT * 2)/ppf.MAX_FEAT; a++){
+    printf("%ld ", s_distro[a]);
+  }
+  printf("\n");
+}
 
 // ----------------------------------------------------------------------------
 // Initialize the subprefetchers along with whatever the hybrid prefetcher
@@ -207,8 +661,69 @@ void O3_CPU::l1i_prefetcher_initialize()
   int PPF_2_L2_THRESH = -256;
   int PPF_3_L2_THRESH = -576;
 
-  printf("PPF_ENABLED %d\n", PPF_ENABLED);
-  printf("PPF_MULTI_LEVEL PREFETCHING %d\n", PPF_MULTI_LEVEL);
+  pf_utility_alloc = UTILITY_ALLOC;
+  pf_voters = VOTERS;
+  pf_vote_quorum = VOTE_QUORUM;
+  pq_free_avg = L1I.get_size(3, 0) << 4;
+  uint64_t telemetry_epoch = TELEMETRY_EPOCH;
+#if RUNTIME_CONFIG
+  hybrid_config.configure(HYBRID_CONFIG_FILE);
+  hybrid_config.load();
+  hybrid_config.get("ppf_enabled", ppf_enabled);
+  hybrid_config.get("ppf_merge", ppf_merge);
+  hybrid_config.get("ppf_multi_level", ppf_multi_level);
+  hybrid_config.get("pfb_shadowcache_enabled", pfb_shadowcache_enabled);
+  hybrid_config.get("utility_alloc", pf_utility_alloc);
+  hybrid_config.get("voters", pf_voters);
+  hybrid_config.get("vote_quorum", pf_vote_quorum);
+  hybrid_config.get("priority_pfb", priority_pfb);
+  hybrid_config.get("priority_pfb_window", priority_pfb_window);
+  hybrid_config.get("pf_batch_dedup", pf_batch_dedup);
+  hybrid_config.get("issue_pipeline", issue_pipeline);
+  hybrid_config.get("pf_retry_window", pf_retry_window);
+  hybrid_config.get("timely_pfb", timely_pfb);
+  hybrid_config.get("timely_lead_factor", timely_lead_factor);
+  hybrid_config.get("ppf_tuner", ppf_tuner_enabled);
+  ppf_tuner_enabled = ppf_tuner_enabled && ppf_enabled;
+#ifdef STATIC_PPF_ENABLED
+  //The weights are int8_t and the table sizes come from the feature lists
+  hybrid_config.get("ppf1_max", PPF_1_MAX, 1, STATIC_PPF_MAX_FEAT);
+  hybrid_config.get("ppf2_max", PPF_2_MAX, 1, STATIC_PPF_MAX_FEAT);
+  hybrid_config.get("ppf3_max", PPF_3_MAX, 1, STATIC_PPF_MAX_FEAT);
+  hybrid_config.unsupported("ppf1_feat_table", "set by PPF1_FEATURES");
+  hybrid_config.unsupported("ppf2_feat_table", "set by PPF2_FEATURES");
+  hybrid_config.unsupported("ppf3_feat_table", "set by PPF3_FEATURES");
+#else
+  hybrid_config.get("ppf1_max", PPF_1_MAX, 1, INT_MAX);
+  hybrid_config.get("ppf2_max", PPF_2_MAX, 1, INT_MAX);
+  hybrid_config.get("ppf3_max", PPF_3_MAX, 1, INT_MAX);
+  hybrid_config.get("ppf1_feat_table", PPF_1_FEAT_TABLE);
+  hybrid_config.get("ppf2_feat_table", PPF_2_FEAT_TABLE);
+  hybrid_config.get("ppf3_feat_table", PPF_3_FEAT_TABLE);
+#endif
+  hybrid_config.get("ppf1_training_thresh", PPF_1_TRAINING_T);
+  hybrid_config.get("ppf2_training_thresh", PPF_2_TRAINING_T);
+  hybrid_config.get("ppf3_training_thresh", PPF_3_TRAINING_T);
+  hybrid_config.get("ppf1_thresh", PPF_1_THRESH);
+  hybrid_config.get("ppf2_thresh", PPF_2_THRESH);
+  hybrid_config.get("ppf3_thresh", PPF_3_THRESH);
+  hybrid_config.get("ppf1_l2_thresh", PPF_1_L2_THRESH);
+  hybrid_config.get("ppf2_l2_thresh", PPF_2_L2_THRESH);
+  hybrid_config.get("ppf3_l2_thresh", PPF_3_L2_THRESH);
+  hybrid_config.get("pf_buff_size", pf_buff_size);
+  //One epoch length for the buffer's statistics and the telemetry, and so
+  //for the tuner and the utility slot split too
+  uint64_t epoch_size = 0;
+  hybrid_config.get("epoch_size", epoch_size);
+  if(epoch_size)
+    pf_epoch_size = telemetry_epoch = epoch_size;
+  hybrid_config.report_unused();
+#endif
+  //The priority buffer keeps its own deadlines
+  pf_timely = timely_pfb && !priority_pfb;
+
+  printf("PPF_ENABLED %d\n", ppf_enabled);
+  printf("PPF_MULTI_LEVEL PREFETCHING %d\n", ppf_multi_level);
 #ifdef ENV_TUNING
   
   if(const char* ppf1_val = getenv("PPF1_THRESH"))
@@ -241,17 +756,18 @@ void O3_CPU::l1i_prefetcher_initialize()
   else
     PPF_3_L2_THRESH = -128;
 
-  ppf1.initialize(PPF_1_MAX, PPF_1_FEAT_TABLE, PPF_1_TRAINING_T, PPF_1_THRESH, PPF_1_L2_THRESH);
-  ppf2.initialize(PPF_2_MAX, PPF_2_FEAT_TABLE, PPF_2_TRAINING_T, PPF_2_THRESH, PPF_2_L2_THRESH);
-  ppf3.initialize(PPF_3_MAX, PPF_3_FEAT_TABLE, PPF_3_TRAINING_T, PPF_3_THRESH, PPF_3_L2_THRESH);
-
 //PPF(uint64_t max_feat, uint64_t feat_table_s, uint64_t training_threshold, int filter_threshold){
+#endif
+
+#if SHARED_PPF
+  //Member 1's weight and training limits, each member's thresholds
+  ppf_shared.initialize(PPF_1_MAX, PPF_1_FEAT_TABLE, PPF_1_TRAINING_T, PPF_1_THRESH, PPF_1_L2_THRESH);
+  ppf_shared.set_unit_thresholds(1, PPF_2_THRESH, PPF_2_L2_THRESH);
+  ppf_shared.set_unit_thresholds(2, PPF_3_THRESH, PPF_3_L2_THRESH);
 #else
-  
   ppf1.initialize(PPF_1_MAX, PPF_1_FEAT_TABLE, PPF_1_TRAINING_T, PPF_1_THRESH, PPF_1_L2_THRESH);
   ppf2.initialize(PPF_2_MAX, PPF_2_FEAT_TABLE, PPF_2_TRAINING_T, PPF_2_THRESH, PPF_2_L2_THRESH);
   ppf3.initialize(PPF_3_MAX, PPF_3_FEAT_TABLE, PPF_3_TRAINING_T, PPF_3_THRESH, PPF_3_L2_THRESH);
-
 #endif
 
   printf("Setting PPF1 Threshold to: %d\n", PPF_1_THRESH);
@@ -269,9 +785,80 @@ void O3_CPU::l1i_prefetcher_initialize()
   // For now, prefetch buffer has no debug comments
   pfb.set_debug_mode(false);
 
+#if !SHARED_PPF
   ppf1.ppf_id = 0;
   ppf2.ppf_id = 1;
   ppf3.ppf_id = 2;
+#endif
+
+  // The same statistics final_stats prints, in machine-readable form
+  stats.configure(STATS_FILE, STATS_FILE_FORMAT, STATS_EPOCH);
+  stats.add_array("pfb.avg_cov", &pfb.avg_cov[0], MAX_NUM_SUBPREFS);
+  stats.add_array("pfb.gen_scenario", &pfb.pf_gen_scenario[0], 8);
+  stats.add_array("pfb.slot_weight", pf_slot_weight, num_prefetchers);
+  stats.add_array("pfb.batch_duplicates", batch_duplicates, num_prefetchers);
+  stats.add_array("pfb.drops.full", pf_full_drops, num_prefetchers);
+  stats.add_array("pfb.drops.aged_out", pf_aged_out, num_prefetchers);
+  stats.add_array("pfb.drops.redundant", pf_redundant_drops, num_prefetchers);
+  stats.add_array("pfb.drops.pq_refused", pq_refused, num_prefetchers);
+  stats.add_array("pfb.drops.retry_expired", retry_expired, num_prefetchers);
+  stats.add_array("pfb.drops.retry_overflow", retry_overflow, num_prefetchers);
+  stats.add_array("pfb.drops.late", pf_late_drops, num_prefetchers);
+  stats.add_array("pfb.retried", retried, num_prefetchers);
+  timeliness.configure(num_prefetchers, 10);
+  timeliness.register_stats(stats, "timeliness.");
+  if(pf_voters){
+    stats.add_array("pfb.vote_issued", pf_vote_issued, num_prefetchers + 1);
+    stats.add_counter("pfb.vote_rejected", &pf_vote_rejected);
+  }
+  if(priority_pfb){
+    ppfb.configure(num_prefetchers, pf_buff_size, priority_pfb_window, PRIORITY_PFB_CONF_CYCLES);
+    ppfb.register_stats(stats, "ppfb.");
+  }
+#ifdef MEASURE
+  //Indexed by the hit bit vector, not in the printed scenario order
+  stats.add_array("sampler.hit_stats", hit_stats, HIT_STATES);
+  stats.add_counter("sampler.total_measured", &total_measured);
+#endif
+#if SHARED_PPF
+  register_ppf_stats(ppf_shared, "ppf.");
+#else
+  register_ppf_stats(ppf1, "ppf1.");
+  register_ppf_stats(ppf2, "ppf2.");
+  register_ppf_stats(ppf3, "ppf3.");
+#endif
+  stats.add_counter("ppf1.filtered", &filtered[0]);
+  stats.add_counter("ppf2.filtered", &filtered[1]);
+  stats.add_counter("ppf3.filtered", &filtered[2]);
+  l1i_prefetcher_register_stats1(stats, "pf1.");
+  l1i_prefetcher_register_stats2(stats, "pf2.");
+  l1i_prefetcher_register_stats3(stats, "pf3.");
+
+  telemetry.configure(num_prefetchers, telemetry_epoch, TELEMETRY_FILE);
+  telemetry.register_stats(stats, "telemetry.");
+  sample_idle_pq = telemetry.recording() || !stats.path.empty() || issue_pipeline;
+  hybrid_profile_register_stats(stats, "profile.", num_prefetchers);
+
+  if(ppf_tuner_enabled){
+    int tuner_thresh[num_prefetchers] = {PPF_1_THRESH, PPF_2_THRESH, PPF_3_THRESH};
+    int tuner_l2_thresh[num_prefetchers] = {PPF_1_L2_THRESH, PPF_2_L2_THRESH, PPF_3_L2_THRESH};
+    tuner.configure(num_prefetchers, tuner_thresh, tuner_l2_thresh, PPF_TUNER_STEP, PPF_TUNER_MIN_STEP, PPF_TUNER_BOUND, PPF_TUNER_LOG);
+    tuner.register_stats(stats, "tuner.");
+  }
+
+  // Everything above is initialized, so the table sizes are final
+  checkpoint.configure(CHECKPOINT_SAVE, CHECKPOINT_LOAD);
+#if SHARED_PPF
+  ppf_shared.register_checkpoint(checkpoint, "ppf.");
+#else
+  ppf1.register_checkpoint(checkpoint, "ppf1.");
+  ppf2.register_checkpoint(checkpoint, "ppf2.");
+  ppf3.register_checkpoint(checkpoint, "ppf3.");
+#endif
+  l1i_prefetcher_register_checkpoint1(checkpoint, "pf1.");
+  l1i_prefetcher_register_checkpoint2(checkpoint, "pf2.");
+  l1i_prefetcher_register_checkpoint3(checkpoint, "pf3.");
+  checkpoint.load();
 }
 
 // ----------------------------------------------------------------------------
@@ -279,9 +866,9 @@ void O3_CPU::l1i_prefetcher_initialize()
 // ----------------------------------------------------------------------------
 void O3_CPU::l1i_prefetcher_branch_operate(uint64_t ip, uint8_t branch_type, uint64_t branch_target)
 {
-  l1i_prefetcher_branch_operate1(ip, branch_type, branch_target);
-  l1i_prefetcher_branch_operate2(ip, branch_type, branch_target);
-  l1i_prefetcher_branch_operate3(ip, branch_type, branch_target);
+  PROFILE_CALL(PROF_BRANCH_OPERATE, 0, l1i_prefetcher_branch_operate1(ip, branch_type, branch_target));
+  PROFILE_CALL(PROF_BRANCH_OPERATE, 1, l1i_prefetcher_branch_operate2(ip, branch_type, branch_target));
+  PROFILE_CALL(PROF_BRANCH_OPERATE, 2, l1i_prefetcher_branch_operate3(ip, branch_type, branch_target));
  
   //PPF Features 
   branch_history <<= 1;
@@ -318,15 +905,19 @@ void O3_CPU::l1i_prefetcher_branch_operate(uint64_t ip, uint8_t branch_type, uin
 void O3_CPU::l1i_prefetcher_cache_operate(uint64_t v_addr, uint8_t cache_hit, uint8_t prefetch_hit)
 {
 
-  l1i_prefetcher_cache_operate1(v_addr, cache_hit, prefetch_hit);
-  l1i_prefetcher_cache_operate2(v_addr, cache_hit, prefetch_hit);
-  l1i_prefetcher_cache_operate3(v_addr, cache_hit, prefetch_hit);
+  PROFILE_CALL(PROF_CACHE_OPERATE, 0, l1i_prefetcher_cache_operate1(v_addr, cache_hit, prefetch_hit));
+  PROFILE_CALL(PROF_CACHE_OPERATE, 1, l1i_prefetcher_cache_operate2(v_addr, cache_hit, prefetch_hit));
+  PROFILE_CALL(PROF_CACHE_OPERATE, 2, l1i_prefetcher_cache_operate3(v_addr, cache_hit, prefetch_hit));
 
+#if SHARED_PPF
+  ppf_shared.update_filter(v_addr, cache_hit);
+#else
   ppf1.update_filter(v_addr, cache_hit);
   ppf2.update_filter(v_addr, cache_hit);
   ppf3.update_filter(v_addr, cache_hit);
+#endif
 
-  ppf1.last_ip = v_addr >> LOG2_BLOCK_SIZE;
+  ppf_last_ip = v_addr >> LOG2_BLOCK_SIZE;
 
   //pfb.get_accuracy(0); 
   //pfb.get_pf_hits(0); 
@@ -356,6 +947,8 @@ void O3_CPU::l1i_prefetcher_cache_operate(uint64_t v_addr, uint8_t cache_hit, ui
   // make this demand access to the shadow cache
   sc.access_cache (v_addr, &sc_hit, &pf_hit, 0, NULL, NULL, ACCESS_DEMAND);
 
+  timeliness.demand(v_addr >> LOG2_BLOCK_SIZE, current_core_cycle[cpu], cache_hit);
+
 #ifdef MEASURE
 
   bool sampler1_hit = false;
@@ -379,13 +972,118 @@ void O3_CPU::l1i_prefetcher_cache_operate(uint64_t v_addr, uint8_t cache_hit, ui
   hit_stats[bit_hit]++;
   total_measured++; 
   assert(bit_hit < HIT_STATES); 
+
+  if(base_sc.in_sampler(v_addr)){
+    bool member_hit[num_prefetchers] = {sampler1_hit, sampler2_hit, sampler3_hit};
+    telemetry.sampled_access(base_hit, member_hit);
+  }
+
   base_sc.update_sampler(v_addr, 0);
-  sampler1.update_sampler(v_addr, 0);
-  sampler2.update_sampler(v_addr, 0);
-  sampler3.update_sampler(v_addr, 0);
+  if(sampler1.update_sampler(v_addr, 0))
+    telemetry.cur.useless[0]++;
+  if(sampler2.update_sampler(v_addr, 0))
+    telemetry.cur.useless[1]++;
+  if(sampler3.update_sampler(v_addr, 0))
+    telemetry.cur.useless[2]++;
 #endif
   // !!! end shadow cache code !!!
 
+  if(ppf_tuner_enabled)
+    tuner.access(cache_hit);
+  if(telemetry.access(current_core_cycle[cpu])){
+    //Halves the older epochs' say in the slot split each epoch
+    if(pf_utility_alloc)
+      for(uint32_t i = 0; i < num_prefetchers; i++)
+        pf_slot_weight[i] = (pf_slot_weight[i] + telemetry.last_utility(i)) / 2;
+    if(ppf_tuner_enabled){
+      int m = tuner.epoch(current_core_cycle[cpu]);
+      if(m >= 0)
+        ppf_set_thresholds(m, tuner.thresh[m], tuner.l2_thresh[m]);
+    }
+  }
+  stats.tick();
+
+  if(all_warmup_complete > NUM_CPUS)
+    checkpoint.save_once();
+}
+
+//Per PPF candidates of ppf_score_cycle, kept to avoid reallocating
+vector<PPF_CONTEXT> ppf_batch_ctx[num_prefetchers];
+vector<uint32_t> ppf_batch_pos[num_prefetchers];
+//One PPF's decisions, and the whole cycle's. Grown to the most candidates
+//seen in a cycle, at most the PQ size
+vector<PF_LEVEL> ppf_batch_levels;
+vector<PF_LEVEL> cycle_levels;
+
+// ----------------------------------------------------------------------------
+// Multi-level PPF decisions for a whole cycle, written to levels. Without
+// PPF_MERGE the features of every candidate are known before any is issued
+// (last_pf is always the previous candidate), so each PPF decides on its
+// candidates in one batch, in the order they are issued.
+// ----------------------------------------------------------------------------
+void ppf_score_cycle(deque<PF_BUFFER_ENTRY> &cycle_prefetches, PF_LEVEL *levels)
+{
+  for(uint32_t a = 0; a < num_prefetchers; a++){
+    ppf_batch_ctx[a].clear();
+    ppf_batch_pos[a].clear();
+  }
+
+  uint64_t prev_pf = last_pf;
+  for(uint32_t j = 0; j < cycle_prefetches.size(); j++){
+    PF_BUFFER_ENTRY &e = cycle_prefetches.at(j);
+    PPF_CONTEXT ctx = {e.pf_addr, ppf_last_ip, branch_history, last_b_target, prev_pf, b_type_hist, e.pref_unit_id};
+    //A shared PPF takes the whole cycle as one batch
+    uint32_t unit = SHARED_PPF ? 0 : e.pref_unit_id;
+    ppf_batch_ctx[unit].push_back(ctx);
+    ppf_batch_pos[unit].push_back(j);
+    prev_pf = e.pf_addr >> LOG2_BLOCK_SIZE;
+  }
+
+  if(ppf_batch_levels.size() < cycle_prefetches.size())
+    ppf_batch_levels.resize(cycle_prefetches.size());
+  for(uint32_t a = 0; a < num_prefetchers; a++){
+    if(ppf_batch_ctx[a].empty())
+      continue;
+    ppf_batch(a, ppf_batch_ctx[a].data(), ppf_batch_ctx[a].size(), ppf_batch_levels.data());
+    for(uint32_t b = 0; b < ppf_batch_pos[a].size(); b++)
+      levels[ppf_batch_pos[a][b]] = ppf_batch_levels[b];
+  }
+}
+
+// ----------------------------------------------------------------------------
+// A prefetch the PQ refused: queued for a retry with issue_pipeline, in place
+// of the oldest one when the queue is full, and lost otherwise
+// ----------------------------------------------------------------------------
+void pq_refuse(const PF_BUFFER_ENTRY &pf, int level, uint64_t cycle)
+{
+  if(!issue_pipeline){
+    pq_refused[pf.pref_unit_id]++;
+    return;
+  }
+  if(retry_queue.size() == PF_RETRY_SIZE){
+    retry_overflow[retry_queue.front().pf.pref_unit_id]++;
+    retry_queue.pop_front();
+  }
+  retry_queue.push_back({pf, level, cycle});
+}
+
+// Hands each member's useful window and lead time to the buffer, which drops
+// the late candidates and orders the members by them (see pf_timely)
+void timely_schedule(uint64_t cycle)
+{
+  pf_timely_now = cycle;
+  for(uint32_t i = 0; i < num_prefetchers; i++){
+    pf_timely_window[i] = timeliness.useful_window(i, timely_lead_factor);
+    pf_timely_lead[i] = (uint64_t)timeliness.avg_lead[i];
+  }
+}
+
+// Averages the free PQ slots over about 8 cycles. A full member buffer makes
+// room for new candidates while it stays under one slot
+void update_pq_trend(int pq_free)
+{
+  pq_free_avg = pq_free_avg - (pq_free_avg >> 3) + (pq_free << 1);
+  pf_replace_oldest = pq_free_avg < 16;
 }
 
 // ----------------------------------------------------------------------------
@@ -393,9 +1091,23 @@ void O3_CPU::l1i_prefetcher_cache_operate(uint64_t v_addr, uint8_t cache_hit, ui
 // ----------------------------------------------------------------------------
 void O3_CPU::l1i_prefetcher_cycle_operate()
 {
-  l1i_prefetcher_cycle_operate1();
-  l1i_prefetcher_cycle_operate2();
-  l1i_prefetcher_cycle_operate3();
+  if(MEMBER1_CYCLE_HOOK)
+    PROFILE_CALL(PROF_CYCLE_OPERATE, 0, l1i_prefetcher_cycle_operate1());
+  if(MEMBER2_CYCLE_HOOK)
+    PROFILE_CALL(PROF_CYCLE_OPERATE, 1, l1i_prefetcher_cycle_operate2());
+  if(MEMBER3_CYCLE_HOOK)
+    PROFILE_CALL(PROF_CYCLE_OPERATE, 2, l1i_prefetcher_cycle_operate3());
+
+  //Nothing handed over or buffered: at most the PQ is sampled
+  if(!pf_work_pending){
+    if(sample_idle_pq){
+      int pq_free = L1I.get_size(3, 0) - L1I.get_occupancy(3, 0);
+      telemetry.idle_cycle(pq_free);
+      if(issue_pipeline)
+        update_pq_trend(pq_free);
+    }
+    return;
+  }
 
   //#ifdef MEASURE
   //int curr_entries[3] = {0,0,0};
@@ -437,32 +1149,43 @@ void O3_CPU::l1i_prefetcher_cycle_operate()
   // the pfb. Note: If the entry doesn't fit in the pfb, it will simply be 
   // dropped.
   for(uint32_t i = 0; i < num_prefetchers; i++) {
-    while(my_prefetch_queue[i].size()) {
+    PROFILE_SCOPE(PROF_DRAIN, i);
+    PF_BATCH &batch = my_prefetch_queue[i];
+    if(pf_batch_dedup)
+      batch_duplicates[i] += batch.dedup(LOG2_BLOCK_SIZE);
+    for(uint32_t r = 0; r < batch.size(); r++) {
       
-      uint64_t p_vaddr = my_prefetch_queue[i].front();
-      long ent = my_prefetch_queue_source_ent[i].front();
+      uint64_t p_vaddr = batch.pf_addr[r];
+      long ent = batch.source_ent[r];
 
       #ifdef MEASURE
       switch(i){
         //FNL
         case 0:
-          sampler1.update_sampler(p_vaddr, 1);
+          if(sampler1.update_sampler(p_vaddr, 1))
+            telemetry.cur.useless[0]++;
           break;
         //DJOLT
         case 1:
-          sampler2.update_sampler(p_vaddr, 1);
+          if(sampler2.update_sampler(p_vaddr, 1))
+            telemetry.cur.useless[1]++;
           break;
         //BARCA 
         case 2:
-          sampler3.update_sampler(p_vaddr, 1);
+          if(sampler3.update_sampler(p_vaddr, 1))
+            telemetry.cur.useless[2]++;
           break;
       }
       #endif
 
-      pfb.add_pf_entry(0,0, p_vaddr, 0, 0, 1, 1, i, current_core_cycle[cpu], ent);
-      my_prefetch_queue[i].pop_front();
-      my_prefetch_queue_source_ent[i].pop_front();
+      if(priority_pfb)
+        ppfb.add_pf_entry(p_vaddr, i, current_core_cycle[cpu], ent, batch.confidence[r] * telemetry.last_utility(i),
+          timely_pfb ? timeliness.useful_window(i, timely_lead_factor) : 0);
+      else
+        pfb.add_pf_entry(0,0, p_vaddr, 0, 0, 1, 1, i, current_core_cycle[cpu], ent);
+      telemetry.cur.generated[i]++;
     }
+    batch.clear();
   }
   
   // Next, call generate_prefetches on pfb to get the prefetches 
@@ -470,32 +1193,78 @@ void O3_CPU::l1i_prefetcher_cycle_operate()
   // The generate_prefetches() function dictates how many addresses 
   // to prefetch!
   int num_to_fetch = L1I.get_size(3, 0) - L1I.get_occupancy(3, 0);
+
+  uint32_t occupancy[num_prefetchers];
+  for(uint32_t i = 0; i < num_prefetchers; i++)
+    occupancy[i] = priority_pfb ? ppfb.num_buff[i] : pfb.num_buff[i];
+  telemetry.cycle(occupancy, num_to_fetch);
+
+  //Prefetches the PQ refused earlier go ahead of the new ones
+  if(issue_pipeline){
+    update_pq_trend(num_to_fetch);
+    while(!retry_queue.empty() && current_core_cycle[cpu] - retry_queue.front().cycle > pf_retry_window){
+      retry_expired[retry_queue.front().pf.pref_unit_id]++;
+      retry_queue.pop_front();
+    }
+    while(!retry_queue.empty() && num_to_fetch > 0){
+      const PF_RETRY &r = retry_queue.front();
+      int accepted = 0;
+      if(r.level < 0)
+        PROFILE_CALL(PROF_ISSUE, r.pf.pref_unit_id, accepted = prefetch_code_line(r.pf.pf_addr, r.pf.pref_unit_id, r.pf.timestamp, r.pf.source_ent));
+      else
+        PROFILE_CALL(PROF_ISSUE, r.pf.pref_unit_id, accepted = prefetch_code_line(r.pf.pf_addr, r.pf.pref_unit_id, r.level, r.pf.timestamp, r.pf.source_ent));
+      if(!accepted)
+        break;
+      //Only now does the shadow cache see it, as for a prefetch accepted first time
+      if(r.level < 0 || r.level == PF_L1){
+        timeliness.issued(r.pf.pf_addr >> LOG2_BLOCK_SIZE, r.pf.pref_unit_id, r.pf.timestamp);
+        sc.access_cache (r.pf.pf_addr, NULL, NULL, 0, NULL, NULL, ACCESS_PREFETCH);
+      }
+      telemetry.cur.issued[r.pf.pref_unit_id]++;
+      retried[r.pf.pref_unit_id]++;
+      retry_queue.pop_front();
+      num_to_fetch--;
+    }
+  }
+
+  if(pf_timely)
+    timely_schedule(current_core_cycle[cpu]);
+
   deque<PF_BUFFER_ENTRY> cycle_prefetches;
 
   //If the shadow cache is enabled to filter redundant prefetches,
   //pass it to the generate_prefetches function to. 
   //Otherwise pass NULL which is handled in prefetch_buffer.cc
-  if(PFB_SHADOWCACHE_ENABLED)
-    cycle_prefetches = pfb.generate_prefetches(num_to_fetch, &sc);
+  if(priority_pfb)
+    PROFILE_CALL(PROF_GENERATE, PROFILE_HYBRID, cycle_prefetches = ppfb.generate_prefetches(num_to_fetch, pfb_shadowcache_enabled ? &sc : NULL, current_core_cycle[cpu]));
+  else if(pfb_shadowcache_enabled)
+    PROFILE_CALL(PROF_GENERATE, PROFILE_HYBRID, cycle_prefetches = pfb.generate_prefetches(num_to_fetch, &sc));
   else
-    cycle_prefetches = pfb.generate_prefetches(num_to_fetch, NULL);
+    PROFILE_CALL(PROF_GENERATE, PROFILE_HYBRID, cycle_prefetches = pfb.generate_prefetches(num_to_fetch, NULL));
     
   bool allow = true;
 
+  if(ppf_enabled && ppf_multi_level && !ppf_merge){
+    if(cycle_levels.size() < cycle_prefetches.size())
+      cycle_levels.resize(cycle_prefetches.size());
+    ppf_score_cycle(cycle_prefetches, cycle_levels.data());
+  }
+
   // Finally, for each of the prefetches generated, call 
   // the ChampSim prefetch_code_line() on the entry's 
   // address value and update the shadow cache
   for(uint32_t j = 0; j < cycle_prefetches.size(); j++) {
    
-    vector<uint64_t> features = {cycle_prefetches.at(j).pf_addr >> LOG2_BLOCK_SIZE, 
-        (cycle_prefetches.at(j).pf_addr >> LOG2_BLOCK_SIZE) & 0xffffff,
-        (ppf1.last_ip >> LOG2_BLOCK_SIZE) & 0xffffff,
-        ppf1.last_ip >> LOG2_BLOCK_SIZE,
+    //Stopped once the PPF made its decision, so only recorded with PPF_ENABLED
+    PROFILE_START(ppf_start);
+    //The PPFs compute their features from this, see PPF_DEFAULT_FEATURES
+    PPF_CONTEXT features = {cycle_prefetches.at(j).pf_addr,
+        ppf_last_ip,
         branch_history,
-        last_b_target >> LOG2_BLOCK_SIZE,
-        //b_taken_hist,
+        last_b_target,
         last_pf,
-        b_type_hist
+        b_type_hist,
+        cycle_prefetches.at(j).pref_unit_id
         };
 
     //printf("Get acc %f\n", //get_cov %f get_harm %f\n",
@@ -510,98 +1279,97 @@ void O3_CPU::l1i_prefetcher_cycle_operate()
     //    ppf1.last_ip >> LOG2_BLOCK_SIZE);
  
  
-    if(PPF_ENABLED){ 
+    if(ppf_enabled){ 
       //Checks if this was requested by multiple prefetchers and then makes a decision based on 
       //the results of 2 or more PFF units
-      if((1 << cycle_prefetches.at(j).pref_unit_id) != cycle_prefetches.at(j).pref_overlap_id && PPF_MERGE){
+      bool overlap = ppf_merge && (1 << cycle_prefetches.at(j).pref_unit_id) != cycle_prefetches.at(j).pref_overlap_id;
+      if(overlap && !ppf_multi_level){
         //printf("%d %d %d\n", 1 << cycle_prefetches.at(j).pref_unit_id, cycle_prefetches.at(j).pref_overlap_id,
         //    cycle_prefetches.at(j).pref_overlap_id & ((1 << 1) >> 1) );
-        int allow_vect = 0;
-        for(uint32_t a = 0; a < num_prefetchers; a++){
-          if(cycle_prefetches.at(j).pref_overlap_id & ((1 << a) >> a) == 1){
-            switch(a){
-              case 0: 
-                allow_vect &= ppf1.check_filter(cycle_prefetches.at(j).pf_addr, features);// << a;
-                //allow_vect |= ppf1.check_filter(cycle_prefetches.at(j).pf_addr, features) << a;
-                filtered_1 += allow;
-                break;
-              case 1: 
-                allow_vect &= ppf2.check_filter(cycle_prefetches.at(j).pf_addr, features);// << a;
-                //allow_vect |= ppf2.check_filter(cycle_prefetches.at(j).pf_addr, features) << a;
-                filtered_2 += allow;
-                break;
-              case 2: 
-                allow_vect &= ppf3.check_filter(cycle_prefetches.at(j).pf_addr, features);// << a;
-                //allow_vect |= ppf3.check_filter(cycle_prefetches.at(j).pf_addr, features) << a;
-                filtered_3 += allow;
-                break;
-            }
-          }
-        }
-        if(allow_vect > 0)
-          allow = true;
+        allow = ppf_merge_check(cycle_prefetches.at(j), features, false) != PF_REJECT;
+        PROFILE_STOP(ppf_start, PROF_PPF, cycle_prefetches.at(j).pref_unit_id);
+
+        if(allow)
+          telemetry.cur.ppf_accept[cycle_prefetches.at(j).pref_unit_id]++;
         else
-          allow = false; 
+          telemetry.cur.ppf_reject[cycle_prefetches.at(j).pref_unit_id]++;
       
       //Check what level, if any, PPF will allow the prefetch to be sent to 
-      }else if(PPF_MULTI_LEVEL){
+      }else if(ppf_multi_level){
         PF_LEVEL pf_level = PF_REJECT;
-        switch(cycle_prefetches.at(j).pref_unit_id){
-          case 0: 
-            pf_level = ppf1.check_filter_level(cycle_prefetches.at(j).pf_addr, features);
-            filtered_1 += pf_level;
-            break;
-          case 1: 
-            pf_level = ppf2.check_filter_level(cycle_prefetches.at(j).pf_addr, features);
-            filtered_2 += pf_level;
-            break;
-          case 2: 
-            pf_level = ppf3.check_filter_level(cycle_prefetches.at(j).pf_addr, features);
-            filtered_3 += pf_level;
-            break;
-        }
+        //Without PPF_MERGE the whole cycle was decided by ppf_score_cycle
+        if(!ppf_merge)
+          pf_level = cycle_levels[j];
+        else if(overlap)
+          pf_level = ppf_merge_check(cycle_prefetches.at(j), features, true);
+        else
+          pf_level = ppf_check(cycle_prefetches.at(j).pref_unit_id, cycle_prefetches.at(j).pf_addr, features, true);
+        //ppf_merge_check counted each member's decision
+        if(!overlap)
+          filtered[cycle_prefetches.at(j).pref_unit_id] += pf_level;
+        if(ppf_merge)
+          PROFILE_STOP(ppf_start, PROF_PPF, cycle_prefetches.at(j).pref_unit_id);
         
         last_pf = cycle_prefetches.at(j).pf_addr >> LOG2_BLOCK_SIZE;
-        if(pf_level != PF_REJECT)
-          prefetch_code_line(cycle_prefetches.at(j).pf_addr, cycle_prefetches.at(j).pref_unit_id, (int)pf_level, cycle_prefetches.at(j).timestamp, cycle_prefetches.at(j).source_ent);
-
-        // !!! shadow cache code !!!
-        // update the shadow cache with this prefetch
-        if(pf_level == PF_L1)
-          sc.access_cache (cycle_prefetches.at(j).pf_addr, NULL, NULL, 0, NULL, NULL, ACCESS_PREFETCH);
+        if(pf_level != PF_REJECT){
+          int accepted = 0;
+          PROFILE_CALL(PROF_ISSUE, cycle_prefetches.at(j).pref_unit_id, accepted = prefetch_code_line(cycle_prefetches.at(j).pf_addr, cycle_prefetches.at(j).pref_unit_id, (int)pf_level, cycle_prefetches.at(j).timestamp, cycle_prefetches.at(j).source_ent));
+          //A refused prefetch is not in flight, so neither counted as issued
+          //nor put in the shadow cache until a retry gets it into the PQ
+          if(!accepted)
+            pq_refuse(cycle_prefetches.at(j), (int)pf_level, current_core_cycle[cpu]);
+          else{
+            if(pf_level == PF_L1){
+              timeliness.issued(cycle_prefetches.at(j).pf_addr >> LOG2_BLOCK_SIZE, cycle_prefetches.at(j).pref_unit_id, cycle_prefetches.at(j).timestamp);
+              // !!! shadow cache code !!!
+              // update the shadow cache with this prefetch
+              sc.access_cache (cycle_prefetches.at(j).pf_addr, NULL, NULL, 0, NULL, NULL, ACCESS_PREFETCH);
+            }
+            telemetry.cur.issued[cycle_prefetches.at(j).pref_unit_id]++;
+          }
+          telemetry.cur.ppf_accept[cycle_prefetches.at(j).pref_unit_id]++;
+        }else{
+          telemetry.cur.ppf_reject[cycle_prefetches.at(j).pref_unit_id]++;
+        }
 
       //Base PPF configuration that gives a ACCEPT/REJECT response
       }else{
-        switch(cycle_prefetches.at(j).pref_unit_id){
-          case 0: 
-            allow = ppf1.check_filter(cycle_prefetches.at(j).pf_addr, features);
-            filtered_1 += allow;
-            break;
-          case 1: 
-            allow = ppf2.check_filter(cycle_prefetches.at(j).pf_addr, features);
-            filtered_2 += allow;
-            break;
-          case 2: 
-            allow = ppf3.check_filter(cycle_prefetches.at(j).pf_addr, features);
-            filtered_3 += allow;
-            break;
-        }
+        allow = ppf_check(cycle_prefetches.at(j).pref_unit_id, cycle_prefetches.at(j).pf_addr, features, false) != PF_REJECT;
+        filtered[cycle_prefetches.at(j).pref_unit_id] += allow;
+        PROFILE_STOP(ppf_start, PROF_PPF, cycle_prefetches.at(j).pref_unit_id);
+
+        if(allow)
+          telemetry.cur.ppf_accept[cycle_prefetches.at(j).pref_unit_id]++;
+        else
+          telemetry.cur.ppf_reject[cycle_prefetches.at(j).pref_unit_id]++;
       }
     }
 
     //Only used if PPF is disabled or its enabled and the multilevel prefetching is not turned on
-    if((allow && !PPF_MULTI_LEVEL) || !PPF_ENABLED){
+    if((allow && !ppf_multi_level) || !ppf_enabled){
       last_pf = cycle_prefetches.at(j).pf_addr >> LOG2_BLOCK_SIZE;
-      prefetch_code_line(cycle_prefetches.at(j).pf_addr, cycle_prefetches.at(j).pref_unit_id, cycle_prefetches.at(j).timestamp, cycle_prefetches.at(j).source_ent);
+      int accepted = 0;
+      PROFILE_CALL(PROF_ISSUE, cycle_prefetches.at(j).pref_unit_id, accepted = prefetch_code_line(cycle_prefetches.at(j).pf_addr, cycle_prefetches.at(j).pref_unit_id, cycle_prefetches.at(j).timestamp, cycle_prefetches.at(j).source_ent));
+      if(!accepted)
+        pq_refuse(cycle_prefetches.at(j), -1, current_core_cycle[cpu]);
+      else{
+        timeliness.issued(cycle_prefetches.at(j).pf_addr >> LOG2_BLOCK_SIZE, cycle_prefetches.at(j).pref_unit_id, cycle_prefetches.at(j).timestamp);
+        telemetry.cur.issued[cycle_prefetches.at(j).pref_unit_id]++;
      
-      // !!! shadow cache code !!!
-      // update the shadow cache with this prefetch
-      sc.access_cache (cycle_prefetches.at(j).pf_addr, NULL, NULL, 0, NULL, NULL, ACCESS_PREFETCH);
+        // !!! shadow cache code !!!
+        // update the shadow cache with this prefetch
+        sc.access_cache (cycle_prefetches.at(j).pf_addr, NULL, NULL, 0, NULL, NULL, ACCESS_PREFETCH);
+      }
     }
     allow = false;
     // !!! end shadow cache code !!!
   }
 
+  //Entries left behind keep the next cycle busy
+  uint32_t buffered = 0;
+  for(uint32_t i = 0; i < num_prefetchers; i++)
+    buffered += priority_pfb ? ppfb.num_buff[i] : pfb.num_buff[i];
+  pf_work_pending = buffered > 0 || !retry_queue.empty();
 }
 
 // ----------------------------------------------------------------------------
@@ -609,10 +1377,13 @@ void O3_CPU::l1i_prefetcher_cycle_operate()
 // ----------------------------------------------------------------------------
 void O3_CPU::l1i_prefetcher_cache_fill(uint64_t v_addr, uint32_t set, uint32_t way, uint8_t prefetch, uint64_t evicted_v_addr, PACKET &filling_entry, BLOCK &evicting_entry)
 {
-  l1i_prefetcher_cache_fill1(v_addr, set, way, prefetch, evicted_v_addr, filling_entry, evicting_entry);
-  l1i_prefetcher_cache_fill2(v_addr, set, way, prefetch, evicted_v_addr, filling_entry, evicting_entry);
-  l1i_prefetcher_cache_fill3(v_addr, set, way, prefetch, evicted_v_addr, filling_entry, evicting_entry);
+  PROFILE_CALL(PROF_CACHE_FILL, 0, l1i_prefetcher_cache_fill1(v_addr, set, way, prefetch, evicted_v_addr, filling_entry, evicting_entry));
+  PROFILE_CALL(PROF_CACHE_FILL, 1, l1i_prefetcher_cache_fill2(v_addr, set, way, prefetch, evicted_v_addr, filling_entry, evicting_entry));
+  PROFILE_CALL(PROF_CACHE_FILL, 2, l1i_prefetcher_cache_fill3(v_addr, set, way, prefetch, evicted_v_addr, filling_entry, evicting_entry));
   
+  if (prefetch)
+    timeliness.fill(v_addr >> LOG2_BLOCK_SIZE, current_core_cycle[cpu]);
+
   // !!! shadow cache code !!!
   if (!prefetch) {
     // if this isn't a prefetch, fill the shadow cache and...
@@ -647,6 +1418,41 @@ void O3_CPU::l1i_prefetcher_final_stats()
   for(uint32_t a = 0; a < 8; a++){
     printf("Gen Scenario %d : %d\n", a, pfb.pf_gen_scenario[a]);
   }
+
+  //Close the partial last epoch so the totals cover the whole run
+  if(telemetry.cur.accesses)
+    telemetry.close_epoch(current_core_cycle[cpu]);
+  telemetry.flush();
+  for(uint32_t i = 0; i < num_prefetchers; i++){
+    printf("Sampled Cov %d: %f Acc %f Harm %f Issued %lu\n", i, telemetry.run_coverage(i),
+      telemetry.run_accuracy(i), telemetry.run_harmfulness(i), telemetry.total.issued[i]);
+  }
+  if(pf_utility_alloc)
+    for(uint32_t i = 0; i < num_prefetchers; i++)
+      printf("Slot weight %d: %f\n", i, pf_slot_weight[i]);
+  if(pf_voters){
+    printf("Voted prefetches:");
+    for(uint32_t i = 1; i <= num_prefetchers; i++)
+      printf(" %lu with %d votes,", pf_vote_issued[i], i);
+    printf(" %lu under the quorum of %u\n", pf_vote_rejected, pf_vote_quorum);
+  }
+  if(pf_batch_dedup)
+    for(uint32_t i = 0; i < num_prefetchers; i++)
+      printf("Batch duplicates %d: %lu\n", i, batch_duplicates[i]);
+  for(uint32_t i = 0; i < num_prefetchers; i++)
+    printf("Prefetch drops %d: %lu buffer full, %lu aged out, %lu redundant, %lu too late, %lu refused by the PQ, %lu retry expired, %lu retry overflow, %lu retried\n",
+      i, pf_full_drops[i], pf_aged_out[i], pf_redundant_drops[i], pf_late_drops[i], pq_refused[i], retry_expired[i], retry_overflow[i], retried[i]);
+  for(uint32_t i = 0; i < num_prefetchers; i++)
+    printf("Timeliness %d: %lu on time, %lu late, average lead %f cycles\n",
+      i, timeliness.on_time[i], timeliness.late[i], timeliness.avg_lead[i]);
+  if(priority_pfb)
+    printf("Priority PFB: %lu merged, %lu stale, %lu displaced, %lu dropped full, %lu redundant\n",
+      ppfb.merged, ppfb.stale, ppfb.displaced, ppfb.full_drops, ppfb.redundant);
+  if(ppf_tuner_enabled){
+    printf("PPF tuner: %lu epochs, %lu moves kept, %lu reverted\n", tuner.epochs, tuner.kept, tuner.reverted);
+    for(uint32_t i = 0; i < num_prefetchers; i++)
+      printf("PPF%u tuned thresholds: %d L2 %d\n", i + 1, tuner.thresh[i], tuner.l2_thresh[i]);
+  }
   
 #ifdef MEASURE
   //Shows the number of prefetches generated per prefetcher per access
@@ -682,112 +1488,26 @@ void O3_CPU::l1i_prefetcher_final_stats()
   printf("Total Measured: %d\n", total_measured);
 #endif
 
-  printf("PPF1 Accept %d PPF1 Reject %d\n", 
-    ppf1.accept_table_hit, ppf1.reject_table_hit);
-  printf("PPF1 Inc %d PPF1 Dec %d\n", 
-    ppf1.increment_weight, ppf1.decrement_weight);
-  printf("PPF1 Accept Trig %d Rej Trig %d\n", 
-    ppf1.accept_trigger, ppf1.reject_trigger);
-  printf("Eviction update %d\n", ppf1.eviction_update);
-  for(int a = 0; a < ppf1.NUM_FEAT; a++)
-    printf("PPF1 Unique Indexes %d: %ld\n", a, ppf1.unique_indexes[a].size());
-  printf("PPF1 Maximum sum seen: %d Minimum sum seen: %d\n",
-    ppf1.sum_max, ppf1.sum_min);
-
-  printf("PPF2 Accept %d PPF2 Reject %d\n", 
-      ppf2.accept_table_hit, ppf2.reject_table_hit);
-  printf("PPF2 Inc %d PPF2 Dec %d\n", 
-    ppf2.increment_weight, ppf2.decrement_weight);
-  printf("PPF2 Accept Trig %d Rej Trig %d\n", 
-    ppf2.accept_trigger, ppf2.reject_trigger);
-  printf("Eviction update %d\n", ppf2.eviction_update);
-  for(int a = 0; a < ppf2.NUM_FEAT; a++)
-    printf("PPF2 Unique Indexes %d: %ld\n", a, ppf2.unique_indexes[a].size());
-  printf("PPF2 Maximum sum seen: %d Minimum sum seen: %d\n",
-    ppf2.sum_max, ppf2.sum_min);
-  
-  printf("PPF3 Accept %d PPF3 Reject %d\n", 
-    ppf3.accept_table_hit, ppf3.reject_table_hit);
-  printf("PPF3 Inc %d PPF3 Dec %d\n", 
-    ppf3.increment_weight, ppf3.decrement_weight);
-  printf("PPF3 Accept Trig %d Rej Trig %d\n", 
-    ppf3.accept_trigger, ppf3.reject_trigger);
-  printf("Eviction update %d\n", ppf3.eviction_update);
-  for(int a = 0; a < ppf2.NUM_FEAT; a++)
-    printf("PPF3 Unique Indexes %d: %ld\n", a, ppf3.unique_indexes[a].size());
-  printf("PPF3 Maximum sum seen: %d Minimum sum seen: %d\n",
-    ppf3.sum_max, ppf3.sum_min);
-
-  printf("PPF1 Weight Distributions\n");
-  for(int a = 0; a < (ppf1.MAX_FEAT * 2)/8; a++)
-    printf("%d:%d ", (-1 * ppf1.MAX_FEAT) + (a * 8), (-1 * ppf1.MAX_FEAT) + (a * 8) + 7);
-  printf("\n");
-  vector<uint64_t> weight_count;
-  for(int a = 0; a < ppf1.NUM_FEAT; a++){
-    weight_count = ppf1.get_feat_distro(a);
-    for(auto w : weight_count)
-      printf("%ld ", w);
-    printf("\n");
-  }
-
-  printf("PPF1 Sum Distribution\n");
-  for(int a = 0; a < (ppf1.MAX_FEAT * ppf1.NUM_FEAT * 2)/ppf1.MAX_FEAT; a++){
-    printf("%d:%d ", (-1 * ppf1.MAX_FEAT * ppf1.NUM_FEAT) + (a * ppf1.MAX_FEAT), (-1 * ppf1.MAX_FEAT * ppf1.NUM_FEAT) + (a * ppf1.MAX_FEAT) + ppf1.MAX_FEAT - 1);
-  }
-  printf("\n");
-  vector<uint64_t> s_distro = ppf1.get_sum_distro();
-  for(int a = 0; a < (ppf1.MAX_FEAT * ppf1.NUM_FEAT * 2)/ppf1.MAX_FEAT; a++){
-    printf("%ld ", s_distro[a]);
-  }
-  printf("\n");
-  
-  printf("PPF1 Filtered: %ld\n", filtered_1);
-
-  printf("PPF2 Weight Distributions\n");
-  for(int a = 0; a < (ppf2.MAX_FEAT * 2)/8; a++)
-    printf("%d:%d ", (-1 * ppf1.MAX_FEAT) + (a * 8), (-1 * ppf1.MAX_FEAT) + (a * 8) + 7);
-  printf("\n");
-  for(int a = 0; a < ppf2.NUM_FEAT; a++){
-    weight_count = ppf2.get_feat_distro(a);
-    for(auto w : weight_count)
-      printf("%ld ", w);
-    printf("\n");
-  }
-
-  printf("PPF2 Sum Distribution\n");
-  for(int a = 0; a < (ppf2.MAX_FEAT * ppf2.NUM_FEAT * 2)/ppf2.MAX_FEAT; a++){
-    printf("%d:%d ", (-1 * ppf2.MAX_FEAT * ppf2.NUM_FEAT) + (a * ppf2.MAX_FEAT), (-1 * ppf2.MAX_FEAT * ppf2.NUM_FEAT) + (a * ppf2.MAX_FEAT) + ppf2.MAX_FEAT - 1);
-  } 
-  printf("\n");
-  s_distro = ppf2.get_sum_distro();
-  for(int a = 0; a < (ppf2.MAX_FEAT * ppf2.NUM_FEAT * 2)/ppf2.MAX_FEAT; a++){
-    printf("%ld ", s_distro[a]);
-  }
-  printf("\n");
-  printf("PPF2 Filtered: %ld\n", filtered_2);
+#if SHARED_PPF
+  print_ppf_summary(ppf_shared, "PPF");
+  print_ppf_distros(ppf_shared, "PPF");
+  for(uint32_t a = 0; a < num_prefetchers; a++)
+    printf("PPF%d Filtered: %ld\n", a + 1, filtered[a]);
+#else
+  print_ppf_summary(ppf1, "PPF1");
+  print_ppf_summary(ppf2, "PPF2");
+  print_ppf_summary(ppf3, "PPF3");
+
+  print_ppf_distros(ppf1, "PPF1");
+  printf("PPF1 Filtered: %ld\n", filtered[0]);
+  print_ppf_distros(ppf2, "PPF2");
+  printf("PPF2 Filtered: %ld\n", filtered[1]);
+  print_ppf_distros(ppf3, "PPF3");
+  printf("PPF3 Filtered: %ld\n", filtered[2]);
+#endif
 
-  printf("PPF3 Weight Distributions\n");
-  for(int a = 0; a < (ppf3.MAX_FEAT * 2)/8; a++)
-    printf("%d:%d ", (-1 * ppf3.MAX_FEAT) + (a * 8), (-1 * ppf3.MAX_FEAT) + (a * 8) + 7);
-  printf("\n");
-  for(int a = 0; a < ppf3.NUM_FEAT; a++){
-    weight_count = ppf3.get_feat_distro(a);
-    for(auto w : weight_count)
-      printf("%ld ", w);
-    printf("\n");
-  } 
-  
-  printf("PPF3 Sum Distribution\n");
-  for(int a = 0; a < (ppf3.MAX_FEAT * ppf3.NUM_FEAT * 2)/ppf3.MAX_FEAT; a++){
-    printf("%d:%d ", (-1 * ppf3.MAX_FEAT * ppf3.NUM_FEAT) + (a * ppf3.MAX_FEAT), (-1 * ppf3.MAX_FEAT * ppf3.NUM_FEAT) + (a * ppf3.MAX_FEAT) + ppf3.MAX_FEAT - 1);
-  } 
-  printf("\n");
-  s_distro = ppf3.get_sum_distro();
-  for(int a = 0; a < (ppf3.MAX_FEAT * ppf3.NUM_FEAT * 2)/ppf3.MAX_FEAT; a++){
-    printf("%ld ", s_distro[a]);
-  }
-  printf("\n");
-  printf("PPF3 Filtered: %ld\n", filtered_3);
+  hybrid_profile_report();
+  stats.dump();
 }
 
 // ----------------------------------------------------------------------------
@@ -795,21 +1515,21 @@ void O3_CPU::l1i_prefetcher_final_stats()
 // ----------------------------------------------------------------------------
 int O3_CPU::prefetch_code_line1(uint64_t pf_v_addr) {
   
-  my_prefetch_queue[0].push_back(pf_v_addr);
-  my_prefetch_queue_source_ent[0].push_back(-1);
+  my_prefetch_queue[0].push(pf_v_addr, -1, 1);
+  pf_work_pending = true;
   return 1;
 }
 
 int O3_CPU::prefetch_code_line2(uint64_t pf_v_addr) {
   
-  my_prefetch_queue[1].push_back(pf_v_addr);
-  my_prefetch_queue_source_ent[1].push_back(-1);
+  my_prefetch_queue[1].push(pf_v_addr, -1, 1);
+  pf_work_pending = true;
   return 1;
 }
 
 int O3_CPU::prefetch_code_line3(uint64_t pf_v_addr, long source_ent) {
   
-  my_prefetch_queue[2].push_back(pf_v_addr);
-  my_prefetch_queue_source_ent[2].push_back(source_ent);
+  my_prefetch_queue[2].push(pf_v_addr, source_ent, 1);
+  pf_work_pending = true;
   return 1;
 }
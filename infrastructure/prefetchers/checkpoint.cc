@@ -0,0 +1,117 @@
+#include "checkpoint.h"
+#include <cassert>
+#include <cstdio>
+#include <cstdlib>
+#include <map>
+
+using namespace std;
+
+// Magic at the start of every checkpoint file
+static const char CHECKPOINT_MAGIC[8] = {'H','Y','B','C','K','P','T','1'};
+
+void HYBRID_CHECKPOINT::configure(const char *default_save, const char *default_load){
+  save_path = default_save;
+  load_path = default_load;
+
+  if(const char *val = getenv("HYBRID_CHECKPOINT_SAVE"))
+    save_path = val;
+  if(const char *val = getenv("HYBRID_CHECKPOINT_LOAD"))
+    load_path = val;
+}
+
+void HYBRID_CHECKPOINT::add_custom(const string &name, function<void(string&)> save, function<bool(CHECKPOINT_READER&)> load){
+  for(auto &s : sections)
+    assert(s.name != name);
+  sections.push_back({name, save, load});
+}
+
+// ----------------------------------------------------------------------------
+// File layout, little endian as written by the host:
+//   header: magic[8], uint32 number of sections
+//   then per section: uint32 name length, name, uint64 size, size bytes
+// ----------------------------------------------------------------------------
+void HYBRID_CHECKPOINT::save(){
+  if(save_path.empty())
+    return;
+
+  FILE *file = fopen(save_path.c_str(), "wb");
+  if(file == NULL){
+    printf("Could not open %s, no checkpoint written\n", save_path.c_str());
+    return;
+  }
+
+  uint32_t count = sections.size();
+  fwrite(CHECKPOINT_MAGIC, 1, sizeof(CHECKPOINT_MAGIC), file);
+  fwrite(&count, sizeof(count), 1, file);
+
+  uint64_t total = 0;
+  string data;
+  for(auto &s : sections){
+    data.clear();
+    s.save(data);
+    uint32_t name_len = s.name.size();
+    uint64_t size = data.size();
+    fwrite(&name_len, sizeof(name_len), 1, file);
+    fwrite(s.name.data(), 1, name_len, file);
+    fwrite(&size, sizeof(size), 1, file);
+    fwrite(data.data(), 1, size, file);
+    total += size;
+  }
+  fclose(file);
+  printf("Checkpoint: wrote %u sections, %lu bytes to %s\n", count, total, save_path.c_str());
+}
+
+void HYBRID_CHECKPOINT::load(){
+  if(load_path.empty())
+    return;
+
+  FILE *file = fopen(load_path.c_str(), "rb");
+  if(file == NULL){
+    printf("Could not open %s, starting cold\n", load_path.c_str());
+    return;
+  }
+  string buf;
+  char chunk[1 << 16];
+  size_t got;
+  while((got = fread(chunk, 1, sizeof(chunk), file)) > 0)
+    buf.append(chunk, got);
+  fclose(file);
+
+  //Name -> bytes of every section in the file
+  map<string, CHECKPOINT_READER> found;
+  CHECKPOINT_READER in(buf.data(), buf.size());
+  char magic[sizeof(CHECKPOINT_MAGIC)];
+  uint32_t count = 0;
+  bool ok = in.read(magic, sizeof(magic)) && memcmp(magic, CHECKPOINT_MAGIC, sizeof(magic)) == 0 && in.get(count);
+  for(uint32_t a = 0; ok && a < count; a++){
+    uint32_t name_len = 0;
+    uint64_t size = 0;
+    ok = in.get(name_len);
+    const char *name = in.next();
+    ok = ok && in.skip(name_len) && in.get(size);
+    if(ok)
+      found.emplace(string(name, name_len), CHECKPOINT_READER(in.next(), size));
+    ok = ok && in.skip(size);
+  }
+  if(!ok){
+    printf("%s is not a complete checkpoint, starting cold\n", load_path.c_str());
+    return;
+  }
+
+  uint32_t restored = 0;
+  for(auto &s : sections){
+    auto it = found.find(s.name);
+    if(it == found.end()){
+      printf("Checkpoint: %s missing\n", s.name.c_str());
+      continue;
+    }
+    if(s.load(it->second))
+      restored++;
+    else
+      printf("Checkpoint: %s does not match this configuration, skipped\n", s.name.c_str());
+    found.erase(it);
+  }
+  for(auto &f : found)
+    printf("Checkpoint: %s not registered, ignored\n", f.first.c_str());
+  printf("Checkpoint: restored %u of %lu sections from %s\n", restored, sections.size(), load_path.c_str());
+}
@@ -0,0 +1,131 @@
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+// ----------------------------------------------------------------------------
+// Warm-start for the hybrids' predictor state. Every component registers its
+// tables once (usually from l1i_prefetcher_initialize) under a dotted name,
+// the same way it registers its statistics with STATS_REGISTRY. save() writes
+// all sections to a binary file, normally at the end of warmup, and load()
+// restores the sections whose name and size match, so another region of the
+// same workload starts with trained tables.
+//
+// Only long-lived predictor state belongs here: statistics, queues and
+// in-flight bookkeeping are rebuilt by the run itself.
+// ----------------------------------------------------------------------------
+
+// The bytes of one section, handed to its loader
+class CHECKPOINT_READER {
+  public:
+    CHECKPOINT_READER(const char *data, size_t size) : data(data), length(size), pos(0) {}
+
+    size_t size() const { return length; }
+    bool done() const { return pos == length; }
+
+    // Copies the next n bytes out, false if the section is too short
+    bool read(void *out, size_t n){
+      if(n > length - pos)
+        return false;
+      memcpy(out, data + pos, n);
+      pos += n;
+      return true;
+    }
+
+    // Steps over the next n bytes, false if the section is too short
+    bool skip(size_t n){
+      if(n > length - pos)
+        return false;
+      pos += n;
+      return true;
+    }
+
+    // The bytes not read yet
+    const char *next() const { return data + pos; }
+
+    template<typename T>
+    bool get(T &val){
+      static_assert(std::is_trivially_copyable<T>::value, "checkpoint values must be trivially copyable");
+      return read(&val, sizeof(T));
+    }
+
+  private:
+    const char *data;
+    size_t length;
+    size_t pos;
+};
+
+template<typename T>
+static inline void checkpoint_put(std::string &out, const T &val){
+  static_assert(std::is_trivially_copyable<T>::value, "checkpoint values must be trivially copyable");
+  out.append((const char *)&val, sizeof(T));
+}
+
+// One named section. The loader returns false if the bytes do not fit the
+// table, and should check that before it overwrites anything
+struct CHECKPOINT_SECTION {
+  std::string name;
+  std::function<void(std::string&)> save;
+  std::function<bool(CHECKPOINT_READER&)> load;
+};
+
+class HYBRID_CHECKPOINT {
+  public:
+    std::vector<CHECKPOINT_SECTION> sections;
+
+    // Where to write and read. Set by configure()
+    std::string save_path;
+    std::string load_path;
+
+    HYBRID_CHECKPOINT() : saved(false) {}
+
+    // Defaults come from the hybrid's #defines, and can be overridden by
+    // HYBRID_CHECKPOINT_SAVE and HYBRID_CHECKPOINT_LOAD. An empty path
+    // disables that direction.
+    void configure(const char *default_save, const char *default_load);
+
+    // Registers a fixed size array of plain values by address
+    template<typename T>
+    void add_array(const std::string &name, T *vals, size_t n){
+      static_assert(std::is_trivially_copyable<T>::value, "checkpoint values must be trivially copyable");
+      add_custom(name,
+        [vals, n](std::string &out){ out.append((const char *)vals, n * sizeof(T)); },
+        [vals, n](CHECKPOINT_READER &in){ return in.size() == n * sizeof(T) && in.read(vals, n * sizeof(T)); });
+    }
+
+    // Registers a vector whose size is fixed by the time load() runs
+    template<typename T>
+    void add_vector(const std::string &name, std::vector<T> *vals){
+      static_assert(std::is_trivially_copyable<T>::value, "checkpoint values must be trivially copyable");
+      add_custom(name,
+        [vals](std::string &out){ out.append((const char *)vals->data(), vals->size() * sizeof(T)); },
+        [vals](CHECKPOINT_READER &in){ return in.size() == vals->size() * sizeof(T) && in.read(vals->data(), in.size()); });
+    }
+
+    // Registers a table with its own encoding, e.g. a map
+    void add_custom(const std::string &name, std::function<void(std::string&)> save, std::function<bool(CHECKPOINT_READER&)> load);
+
+    // Writes every section to save_path
+    void save();
+
+    // Restores the sections found in load_path, reports the ones it skipped
+    void load();
+
+    // save() the first time it is called, for the end of warmup
+    void save_once(){
+      if(saved)
+        return;
+      saved = true;
+      save();
+    }
+
+  private:
+    bool saved;
+};
+
+#endif
@@ -0,0 +1,156 @@
+#include "epoch_telemetry.h"
+#include <cassert>
+#include <cstdlib>
+#include <cstring>
+
+using namespace std;
+
+// Magic at the start of every telemetry file
+static const char TELEMETRY_MAGIC[8] = {'H','Y','B','T','E','L','E','1'};
+
+static float ratio(uint64_t num, uint64_t den){
+  return den == 0 ? 0.0 : (float)num / den;
+}
+
+EPOCH_TELEMETRY::EPOCH_TELEMETRY() : num_pfs(0), epoch_length(0), epoch_num(0), ring_count(0), file(NULL){
+  memset(&cur, 0, sizeof(cur));
+  memset(&total, 0, sizeof(total));
+  memset(&last, 0, sizeof(last));
+}
+
+EPOCH_TELEMETRY::~EPOCH_TELEMETRY(){
+  flush();
+  if(file != NULL)
+    fclose(file);
+}
+
+void EPOCH_TELEMETRY::configure(uint32_t n_pfs, uint64_t length, const char *default_path){
+  assert(n_pfs <= TELEMETRY_MAX_PFS);
+  num_pfs = n_pfs;
+  epoch_length = length;
+  path = default_path;
+
+  if(const char *val = getenv("HYBRID_TELEMETRY_FILE"))
+    path = val;
+}
+
+void EPOCH_TELEMETRY::add_counts(EPOCH_COUNTS &to, const EPOCH_COUNTS &from){
+  to.accesses += from.accesses;
+  to.cycles += from.cycles;
+  to.sampled += from.sampled;
+  to.base_misses += from.base_misses;
+  for(uint32_t a = 0; a < TELEMETRY_MAX_PFS; a++){
+    to.covered[a] += from.covered[a];
+    to.harmful[a] += from.harmful[a];
+    to.useless[a] += from.useless[a];
+    to.generated[a] += from.generated[a];
+    to.issued[a] += from.issued[a];
+    to.ppf_accept[a] += from.ppf_accept[a];
+    to.ppf_reject[a] += from.ppf_reject[a];
+    to.queue_sum[a] += from.queue_sum[a];
+    if(from.queue_max[a] > to.queue_max[a])
+      to.queue_max[a] = from.queue_max[a];
+  }
+  to.pq_free_sum += from.pq_free_sum;
+  to.pq_full_cycles += from.pq_full_cycles;
+}
+
+// ----------------------------------------------------------------------------
+// Derives the epoch's ratios, appends it to the ring and starts a new epoch.
+// The ring is only written out when full, so the common case is a copy.
+// ----------------------------------------------------------------------------
+void EPOCH_TELEMETRY::close_epoch(uint64_t cycle){
+  EPOCH_RECORD &r = last;
+  r.epoch = epoch_num;
+  r.end_cycle = cycle;
+  r.counts = cur;
+  for(uint32_t a = 0; a < TELEMETRY_MAX_PFS; a++){
+    r.coverage[a] = ratio(cur.covered[a], cur.base_misses);
+    r.accuracy[a] = ratio(cur.covered[a], cur.covered[a] + cur.useless[a]);
+    r.harmfulness[a] = ratio(cur.harmful[a], cur.base_misses);
+    r.avg_queue[a] = ratio(cur.queue_sum[a], cur.cycles);
+  }
+
+  add_counts(total, cur);
+  memset(&cur, 0, sizeof(cur));
+  epoch_num++;
+
+  if(path.empty())
+    return;
+
+  ring[ring_count++] = r;
+  if(ring_count == TELEMETRY_RING_SIZE)
+    flush();
+}
+
+// ----------------------------------------------------------------------------
+// File layout, little endian as written by the host:
+//   header: magic[8], uint32 num_pfs, uint32 sizeof(EPOCH_RECORD),
+//           uint64 epoch_length
+//   then one raw EPOCH_RECORD per closed epoch, in order
+// ----------------------------------------------------------------------------
+void EPOCH_TELEMETRY::flush(){
+  if(path.empty() || ring_count == 0)
+    return;
+
+  if(file == NULL){
+    file = fopen(path.c_str(), "wb");
+    if(file == NULL){
+      printf("Could not open %s, disabling telemetry output\n", path.c_str());
+      path.clear();
+      ring_count = 0;
+      return;
+    }
+    uint32_t rec_size = sizeof(EPOCH_RECORD);
+    fwrite(TELEMETRY_MAGIC, 1, sizeof(TELEMETRY_MAGIC), file);
+    fwrite(&num_pfs, sizeof(num_pfs), 1, file);
+    fwrite(&rec_size, sizeof(rec_size), 1, file);
+    fwrite(&epoch_length, sizeof(epoch_length), 1, file);
+  }
+
+  fwrite(ring, sizeof(EPOCH_RECORD), ring_count, file);
+  fflush(file);
+  ring_count = 0;
+}
+
+float EPOCH_TELEMETRY::run_coverage(uint32_t pf){
+  return ratio(total.covered[pf] + cur.covered[pf], total.base_misses + cur.base_misses);
+}
+
+float EPOCH_TELEMETRY::run_accuracy(uint32_t pf){
+  uint64_t covered = total.covered[pf] + cur.covered[pf];
+  return ratio(covered, covered + total.useless[pf] + cur.useless[pf]);
+}
+
+float EPOCH_TELEMETRY::run_harmfulness(uint32_t pf){
+  return ratio(total.harmful[pf] + cur.harmful[pf], total.base_misses + cur.base_misses);
+}
+
+float EPOCH_TELEMETRY::last_utility(uint32_t pf){
+  const EPOCH_COUNTS &c = last.counts;
+  if(c.covered[pf] <= c.harmful[pf])
+    return 0.0;
+  return ratio(c.covered[pf] - c.harmful[pf], c.covered[pf] + c.useless[pf]);
+}
+
+void EPOCH_TELEMETRY::register_stats(STATS_REGISTRY &stats, const string &prefix){
+  stats.add_counter(prefix + "epochs", &epoch_num);
+  stats.add_counter(prefix + "sampled", &total.sampled);
+  stats.add_counter(prefix + "base_misses", &total.base_misses);
+  stats.add_array(prefix + "covered", total.covered, num_pfs);
+  stats.add_array(prefix + "harmful", total.harmful, num_pfs);
+  stats.add_array(prefix + "useless", total.useless, num_pfs);
+  stats.add_array(prefix + "generated", total.generated, num_pfs);
+  stats.add_array(prefix + "issued", total.issued, num_pfs);
+  stats.add_array(prefix + "ppf_accept", total.ppf_accept, num_pfs);
+  stats.add_array(prefix + "ppf_reject", total.ppf_reject, num_pfs);
+  stats.add_array(prefix + "queue_max", total.queue_max, num_pfs);
+  stats.add_counter(prefix + "pq_full_cycles", &total.pq_full_cycles);
+
+  for(uint32_t a = 0; a < num_pfs; a++){
+    string pf = to_string(a + 1);
+    stats.add_function(prefix + "coverage." + pf, function<double()>([this, a](){ return run_coverage(a); }));
+    stats.add_function(prefix + "accuracy." + pf, function<double()>([this, a](){ return run_accuracy(a); }));
+    stats.add_function(prefix + "harmfulness." + pf, function<double()>([this, a](){ return run_harmfulness(a); }));
+  }
+}
@@ -0,0 +1,149 @@
+#ifndef EPOCH_TELEMETRY_H
+#define EPOCH_TELEMETRY_H
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include "stats_registry.h"
+
+// Upper bound on hybrid members, matches MAX_NUM_SUBPREFS in prefetch_buffer.h
+#define TELEMETRY_MAX_PFS 4
+
+// Number of closed epochs buffered in memory before they are written out
+#define TELEMETRY_RING_SIZE 64
+
+// ----------------------------------------------------------------------------
+// Raw event counts for one epoch. Everything is an integer count so whole-run
+// averages are exact; ratios are only derived when an epoch is closed.
+// The sampled counts come from the MEASURE samplers, so they only cover the
+// sampled sets (see set_sampler.cc).
+// ----------------------------------------------------------------------------
+struct EPOCH_COUNTS {
+  uint64_t accesses;                          // L1I accesses seen by the hybrid
+  uint64_t cycles;                            // cycle_operate calls
+  uint64_t sampled;                           // accesses to sampled sets
+  uint64_t base_misses;                       // ...that miss without prefetching
+
+  uint64_t covered[TELEMETRY_MAX_PFS];        // base miss turned into a hit by the member
+  uint64_t harmful[TELEMETRY_MAX_PFS];        // base hit turned into a miss by the member
+  uint64_t useless[TELEMETRY_MAX_PFS];        // member's prefetches evicted unused
+
+  uint64_t generated[TELEMETRY_MAX_PFS];      // candidates moved into the prefetch buffer
+  uint64_t issued[TELEMETRY_MAX_PFS];         // accepted by the PQ, retries included
+  uint64_t ppf_accept[TELEMETRY_MAX_PFS];     // PPF sent it to the L1I or L2
+  uint64_t ppf_reject[TELEMETRY_MAX_PFS];
+
+  uint64_t queue_sum[TELEMETRY_MAX_PFS];      // buffer occupancy summed over cycles
+  uint64_t queue_max[TELEMETRY_MAX_PFS];
+  uint64_t pq_free_sum;                       // free L1I PQ slots summed over cycles
+  uint64_t pq_full_cycles;                    // cycles with no free PQ slot
+};
+
+// ----------------------------------------------------------------------------
+// One closed epoch as written to the telemetry file
+// ----------------------------------------------------------------------------
+struct EPOCH_RECORD {
+  uint64_t epoch;
+  uint64_t end_cycle;
+  EPOCH_COUNTS counts;
+
+  // Derived from counts when the epoch is closed
+  float coverage[TELEMETRY_MAX_PFS];          // covered / base_misses
+  float accuracy[TELEMETRY_MAX_PFS];          // covered / (covered + useless)
+  float harmfulness[TELEMETRY_MAX_PFS];       // harmful / base_misses, as PREFETCH_BUFFER::get_harmful
+  float avg_queue[TELEMETRY_MAX_PFS];         // queue_sum / cycles
+};
+
+class EPOCH_TELEMETRY {
+  public:
+    uint32_t num_pfs;
+    uint64_t epoch_length;
+    uint64_t epoch_num;
+
+    // The hybrid increments the current epoch's counters directly
+    EPOCH_COUNTS cur;
+
+    // Sum over all closed epochs, run_* also add the open one
+    EPOCH_COUNTS total;
+
+    // The most recently closed epoch, valid once epoch_num > 0
+    EPOCH_RECORD last;
+
+    EPOCH_TELEMETRY();
+    ~EPOCH_TELEMETRY();
+
+    // HYBRID_TELEMETRY_FILE overrides default_path, an empty path keeps the
+    // time series in memory only
+    void configure(uint32_t num_pfs, uint64_t epoch_length, const char *default_path);
+
+    // True if the time series goes to a file
+    bool recording() const { return !path.empty(); }
+
+    // Records one demand access to a sampled set given the base sampler's and
+    // each member's sampler outcome
+    void sampled_access(bool base_hit, const bool *member_hit){
+      cur.sampled++;
+      if(!base_hit)
+        cur.base_misses++;
+      for(uint32_t a = 0; a < num_pfs; a++){
+        if(!base_hit && member_hit[a])
+          cur.covered[a]++;
+        else if(base_hit && !member_hit[a])
+          cur.harmful[a]++;
+      }
+    }
+
+    // Records the buffer occupancy and free PQ slots seen this cycle
+    void cycle(const uint32_t *buffer_occupancy, int pq_free){
+      for(uint32_t a = 0; a < num_pfs; a++){
+        cur.queue_sum[a] += buffer_occupancy[a];
+        if(buffer_occupancy[a] > cur.queue_max[a])
+          cur.queue_max[a] = buffer_occupancy[a];
+      }
+      idle_cycle(pq_free);
+    }
+
+    // Same as cycle() with every buffer empty
+    void idle_cycle(int pq_free){
+      cur.cycles++;
+      if(pq_free > 0)
+        cur.pq_free_sum += pq_free;
+      else
+        cur.pq_full_cycles++;
+    }
+
+    // Counts one L1I access, returns true if it closed an epoch
+    bool access(uint64_t cycle){
+      if(++cur.accesses < epoch_length)
+        return false;
+      close_epoch(cycle);
+      return true;
+    }
+
+    void close_epoch(uint64_t cycle);
+
+    // Writes out any buffered epochs
+    void flush();
+
+    // Whole-run sampled metrics computed from the integer totals
+    float run_coverage(uint32_t pf);
+    float run_accuracy(uint32_t pf);
+    float run_harmfulness(uint32_t pf);
+
+    // Sampled misses the member removed net of those it caused, per prefetch
+    // of it that was used or evicted, in the last closed epoch. Zero for a
+    // member that did more harm than good
+    float last_utility(uint32_t pf);
+
+    void register_stats(STATS_REGISTRY &stats, const std::string &prefix);
+
+  private:
+    EPOCH_RECORD ring[TELEMETRY_RING_SIZE];
+    uint32_t ring_count;
+    std::string path;
+    FILE *file;
+
+    void add_counts(EPOCH_COUNTS &to, const EPOCH_COUNTS &from);
+};
+
+#endif
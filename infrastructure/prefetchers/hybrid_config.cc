@@ -0,0 +1,243 @@
+#include "hybrid_config.h"
+#include <cassert>
+#include <cctype>
+#include <cstdio>
+#include <cstdlib>
+
+using namespace std;
+
+// ----------------------------------------------------------------------------
+// Just enough of a JSON parser for ChampSim's config files: the document is
+// walked once, everything outside the top-level "hybrid" object is skipped
+// and its members are collected as numbers
+// ----------------------------------------------------------------------------
+class CONFIG_PARSER {
+  public:
+    CONFIG_PARSER(const string &text) : s(text), pos(0) {}
+
+    bool parse(map<string, double> &out){
+      ws();
+      if(!accept('{'))
+        return false;
+      ws();
+      if(peek() == '}')
+        return true;
+      do {
+        string key;
+        ws();
+        if(!string_val(key))
+          return false;
+        ws();
+        if(!accept(':'))
+          return false;
+        ws();
+        if(key == "hybrid"){
+          if(!section(out))
+            return false;
+        }else if(!skip_value())
+          return false;
+        ws();
+      } while(accept(','));
+      return accept('}');
+    }
+
+  private:
+    const string &s;
+    size_t pos;
+
+    char peek(){ return pos < s.size() ? s[pos] : 0; }
+    void ws(){ while(pos < s.size() && isspace((unsigned char)s[pos])) pos++; }
+    bool accept(char c){ if(peek() != c) return false; pos++; return true; }
+
+    bool literal(const char *word){
+      string w(word);
+      if(s.compare(pos, w.size(), w) != 0)
+        return false;
+      pos += w.size();
+      return true;
+    }
+
+    //No escapes beyond skipping the escaped character, keys are plain names
+    bool string_val(string &out){
+      if(!accept('"'))
+        return false;
+      while(pos < s.size() && s[pos] != '"'){
+        if(s[pos] == '\\')
+          pos++;
+        if(pos < s.size())
+          out += s[pos++];
+      }
+      return accept('"');
+    }
+
+    bool number(double &out){
+      const char *start = s.c_str() + pos;
+      char *end;
+      out = strtod(start, &end);
+      if(end == start)
+        return false;
+      pos += end - start;
+      return true;
+    }
+
+    bool skip_value(){
+      char c = peek();
+      if(c == '"'){
+        string unused;
+        return string_val(unused);
+      }
+      if(c == '{' || c == '['){
+        char close = c == '{' ? '}' : ']';
+        pos++;
+        ws();
+        if(accept(close))
+          return true;
+        do {
+          ws();
+          if(c == '{'){
+            string key;
+            if(!string_val(key))
+              return false;
+            ws();
+            if(!accept(':'))
+              return false;
+            ws();
+          }
+          if(!skip_value())
+            return false;
+          ws();
+        } while(accept(','));
+        return accept(close);
+      }
+      if(literal("true") || literal("false") || literal("null"))
+        return true;
+      double unused;
+      return number(unused);
+    }
+
+    bool section(map<string, double> &out){
+      if(!accept('{'))
+        return false;
+      ws();
+      if(accept('}'))
+        return true;
+      do {
+        string key;
+        double val;
+        ws();
+        if(!string_val(key))
+          return false;
+        ws();
+        if(!accept(':'))
+          return false;
+        ws();
+        if(literal("true"))
+          val = 1;
+        else if(literal("false"))
+          val = 0;
+        else if(!number(val))
+          return false;
+        out[key] = val;
+        ws();
+      } while(accept(','));
+      return accept('}');
+    }
+};
+
+void HYBRID_CONFIG::configure(const char *default_path){
+  path = default_path;
+
+  if(const char *val = getenv("HYBRID_CONFIG"))
+    path = val;
+}
+
+void HYBRID_CONFIG::load(){
+  if(path.empty())
+    return;
+
+  FILE *file = fopen(path.c_str(), "r");
+  if(file == NULL)
+    printf("Could not open hybrid config %s\n", path.c_str());
+  assert(file != NULL);
+  string text;
+  char chunk[4096];
+  size_t got;
+  while((got = fread(chunk, 1, sizeof(chunk), file)) > 0)
+    text.append(chunk, got);
+  fclose(file);
+
+  CONFIG_PARSER parser(text);
+  bool parsed = parser.parse(values);
+  if(!parsed)
+    printf("Could not parse the hybrid section of %s\n", path.c_str());
+  assert(parsed);
+  printf("Hybrid config: %lu values from %s\n", values.size(), path.c_str());
+}
+
+bool HYBRID_CONFIG::find(const string &name, double &val){
+  auto it = values.find(name);
+  if(it == values.end())
+    return false;
+  used.insert(name);
+  val = it->second;
+  printf("Hybrid config: %s = %g\n", name.c_str(), val);
+  return true;
+}
+
+void HYBRID_CONFIG::get(const string &name, bool &val){
+  double v;
+  if(find(name, v))
+    val = v != 0;
+}
+
+void HYBRID_CONFIG::get(const string &name, int &val){
+  double v;
+  if(find(name, v))
+    val = (int)v;
+}
+
+void HYBRID_CONFIG::get(const string &name, uint32_t &val){
+  double v;
+  if(find(name, v)){
+    assert(v >= 0);
+    val = (uint32_t)v;
+  }
+}
+
+void HYBRID_CONFIG::get(const string &name, uint64_t &val){
+  double v;
+  if(find(name, v)){
+    assert(v >= 0);
+    val = (uint64_t)v;
+  }
+}
+
+void HYBRID_CONFIG::get(const string &name, float &val){
+  double v;
+  if(find(name, v))
+    val = v;
+}
+
+void HYBRID_CONFIG::get(const string &name, int &val, int min, int max){
+  double v;
+  if(!find(name, v))
+    return;
+  if(v < min || v > max){
+    printf("Hybrid config: error, %s = %g is outside [%d, %d], keeping %d\n", name.c_str(), v, min, max, val);
+    return;
+  }
+  val = (int)v;
+}
+
+void HYBRID_CONFIG::unsupported(const string &name, const char *why){
+  if(values.find(name) == values.end())
+    return;
+  used.insert(name);
+  printf("Hybrid config: %s is not supported in this build (%s), ignored\n", name.c_str(), why);
+}
+
+void HYBRID_CONFIG::report_unused(){
+  for(auto &v : values)
+    if(used.find(v.first) == used.end())
+      printf("Hybrid config: %s is not a parameter of this hybrid, ignored\n", v.first.c_str());
+}
@@ -0,0 +1,55 @@
+#ifndef HYBRID_CONFIG_H
+#define HYBRID_CONFIG_H
+
+#include <cstdint>
+#include <map>
+#include <set>
+#include <string>
+
+// ----------------------------------------------------------------------------
+// Runtime parameters of a hybrid, so a sweep over thresholds or switches is
+// one build and many runs. They come from the "hybrid" object of a JSON file,
+// normally the combination's own ChampSim config:
+//
+//   "hybrid": { "ppf_enabled": true, "ppf1_thresh": -256, "pf_buff_size": 16 }
+//
+// Values are numbers or true/false. Keys the hybrid does not read are
+// reported, so a misspelt key does not silently run the default.
+// ----------------------------------------------------------------------------
+class HYBRID_CONFIG {
+  public:
+    std::string path;
+
+    // HYBRID_CONFIG overrides default_path, an empty path keeps the defaults
+    void configure(const char *default_path);
+
+    // Reads the "hybrid" object of path, asserts if the file is given but
+    // cannot be read or parsed
+    void load();
+
+    // Overwrites val if the section sets name
+    void get(const std::string &name, bool &val);
+    void get(const std::string &name, int &val);
+    void get(const std::string &name, uint32_t &val);
+    void get(const std::string &name, uint64_t &val);
+    void get(const std::string &name, float &val);
+
+    // Same as get, but a value outside [min, max] is reported as an error and
+    // val keeps its default
+    void get(const std::string &name, int &val, int min, int max);
+
+    // A key this build cannot honor: if the section sets it, it is reported
+    // with why and otherwise ignored
+    void unsupported(const std::string &name, const char *why);
+
+    // Reports the keys no get() asked for
+    void report_unused();
+
+  private:
+    std::map<std::string, double> values;
+    std::set<std::string> used;
+
+    bool find(const std::string &name, double &val);
+};
+
+#endif
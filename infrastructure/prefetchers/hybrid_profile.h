@@ -0,0 +1,172 @@
+#ifndef HYBRID_PROFILE_H
+#define HYBRID_PROFILE_H
+
+// ----------------------------------------------------------------------------
+// Scoped timers for the hybrid's hot path. Only compiled in when the hybrid
+// defines HYBRID_PROFILE before including this file; otherwise every macro
+// below expands to the bare statement and nothing is measured.
+//
+// Each scope adds its duration to a (stage, member) slot: count, total, max
+// and a log2 histogram. Time is in rdtsc ticks on x86 and nanoseconds from
+// clock_gettime elsewhere.
+// ----------------------------------------------------------------------------
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include "stats_registry.h"
+
+enum PROF_STAGE {
+  PROF_BRANCH_OPERATE,
+  PROF_CACHE_OPERATE,
+  PROF_CYCLE_OPERATE,
+  PROF_CACHE_FILL,
+  PROF_DRAIN,         // my_prefetch_queue -> pfb.add_pf_entry
+  PROF_GENERATE,      // pfb.generate_prefetches
+  PROF_PPF,           // feature construction and the filter check
+  PROF_ISSUE,         // prefetch_code_line
+  PROF_NUM_STAGES
+};
+
+// Slot for stages not attributed to a single member
+#define PROFILE_MAX_PFS 4
+#define PROFILE_HYBRID PROFILE_MAX_PFS
+
+#define PROFILE_HIST_BUCKETS 32
+
+#ifdef HYBRID_PROFILE
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define PROFILE_UNIT "ticks"
+static inline uint64_t profile_now(){ return __rdtsc(); }
+#else
+#include <time.h>
+#define PROFILE_UNIT "ns"
+static inline uint64_t profile_now(){
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+#endif
+
+struct PROFILE_SLOT {
+  uint64_t count;
+  uint64_t total;
+  uint64_t max;
+  uint64_t hist[PROFILE_HIST_BUCKETS];    // bucket b holds durations in [2^(b-1), 2^b)
+};
+
+class HYBRID_PROFILER {
+  public:
+    PROFILE_SLOT slots[PROF_NUM_STAGES][PROFILE_MAX_PFS + 1];
+
+    HYBRID_PROFILER(){
+      for(int a = 0; a < PROF_NUM_STAGES; a++)
+        for(int b = 0; b <= PROFILE_MAX_PFS; b++)
+          slots[a][b] = PROFILE_SLOT();
+    }
+
+    void record(uint32_t stage, uint32_t member, uint64_t ticks){
+      PROFILE_SLOT &s = slots[stage][member];
+      s.count++;
+      s.total += ticks;
+      if(ticks > s.max)
+        s.max = ticks;
+      uint32_t bucket = ticks == 0 ? 0 : 64 - __builtin_clzll(ticks);
+      if(bucket >= PROFILE_HIST_BUCKETS)
+        bucket = PROFILE_HIST_BUCKETS - 1;
+      s.hist[bucket]++;
+    }
+};
+
+// One profiler per simulation, the hybrid is a single translation unit
+static inline HYBRID_PROFILER &hybrid_profiler(){
+  static HYBRID_PROFILER prof;
+  return prof;
+}
+
+class PROFILE_TIMER {
+  public:
+    PROFILE_TIMER(uint32_t stage, uint32_t member) : stage(stage), member(member), start(profile_now()) {}
+    ~PROFILE_TIMER(){ hybrid_profiler().record(stage, member, profile_now() - start); }
+  private:
+    uint32_t stage, member;
+    uint64_t start;
+};
+
+#define PROFILE_CONCAT2(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT2(a, b)
+
+// Times the rest of the enclosing scope
+#define PROFILE_SCOPE(stage, member) PROFILE_TIMER PROFILE_CONCAT(profile_timer_, __LINE__)(stage, member)
+
+// Times a single statement
+#define PROFILE_CALL(stage, member, call) do { PROFILE_SCOPE(stage, member); call; } while(0)
+
+// For regions that do not map onto a scope, e.g. one with several exits
+#define PROFILE_START(var) uint64_t var = profile_now()
+#define PROFILE_STOP(var, stage, member) hybrid_profiler().record(stage, member, profile_now() - var)
+
+static const char *PROF_STAGE_NAMES[PROF_NUM_STAGES] = {
+  "branch_operate", "cache_operate", "cycle_operate", "cache_fill",
+  "drain", "generate", "ppf", "issue"
+};
+
+static inline std::string profile_member_name(uint32_t member){
+  return member == PROFILE_HYBRID ? std::string("hybrid") : "pf" + std::to_string(member + 1);
+}
+
+// ----------------------------------------------------------------------------
+// Prints every slot that saw at least one sample, followed by its histogram
+// ----------------------------------------------------------------------------
+static inline void hybrid_profile_report(){
+  HYBRID_PROFILER &prof = hybrid_profiler();
+  printf("Hybrid profile (%s)\n", PROFILE_UNIT);
+  printf("%-16s %-8s %12s %16s %10s %10s\n", "stage", "member", "count", "total", "avg", "max");
+  for(int a = 0; a < PROF_NUM_STAGES; a++){
+    for(int b = 0; b <= PROFILE_MAX_PFS; b++){
+      PROFILE_SLOT &s = prof.slots[a][b];
+      if(s.count == 0)
+        continue;
+      printf("%-16s %-8s %12lu %16lu %10.1f %10lu\n", PROF_STAGE_NAMES[a], profile_member_name(b).c_str(),
+        s.count, s.total, (double)s.total / s.count, s.max);
+      printf("  log2 hist:");
+      for(int c = 0; c < PROFILE_HIST_BUCKETS; c++)
+        if(s.hist[c])
+          printf(" %d:%lu", c, s.hist[c]);
+      printf("\n");
+    }
+  }
+}
+
+// Registers the slots of the first num_pfs members and the hybrid's own
+static inline void hybrid_profile_register_stats(STATS_REGISTRY &stats, const std::string &prefix, uint32_t num_pfs){
+  HYBRID_PROFILER &prof = hybrid_profiler();
+  for(int a = 0; a < PROF_NUM_STAGES; a++){
+    for(uint32_t b = 0; b <= PROFILE_MAX_PFS; b++){
+      if(b >= num_pfs && b != PROFILE_HYBRID)
+        continue;
+      std::string name = prefix + PROF_STAGE_NAMES[a] + "." + profile_member_name(b) + ".";
+      PROFILE_SLOT &s = prof.slots[a][b];
+      stats.add_counter(name + "count", &s.count);
+      stats.add_counter(name + "total", &s.total);
+      stats.add_counter(name + "max", &s.max);
+      stats.add_array(name + "hist", s.hist, PROFILE_HIST_BUCKETS);
+    }
+  }
+}
+
+#else
+
+#define PROFILE_SCOPE(stage, member)
+#define PROFILE_CALL(stage, member, call) call
+#define PROFILE_START(var)
+#define PROFILE_STOP(var, stage, member)
+
+static inline void hybrid_profile_report(){}
+static inline void hybrid_profile_register_stats(STATS_REGISTRY &stats, const std::string &prefix, uint32_t num_pfs){}
+
+#endif
+
+#endif
@@ -0,0 +1,88 @@
+#ifndef PF_BATCH_H
+#define PF_BATCH_H
+
+#include <cassert>
+#include <cstdint>
+#include <vector>
+
+// One prefetch candidate handed to the hybrid. A confidence of 1 leaves the
+// hybrid's own estimate of the member unchanged
+struct PF_RECORD {
+  uint64_t pf_addr;
+  long source_ent;
+  float confidence;
+};
+
+// ----------------------------------------------------------------------------
+// Fixed-size scratch array a member fills during one call and hands to
+// prefetch_code_lines as a span, in place of one prefetch_code_line per line
+// ----------------------------------------------------------------------------
+template <uint32_t N>
+struct PF_RECORDS {
+  PF_RECORD r[N];
+  uint32_t n = 0;
+
+  void add(uint64_t pf_addr, long source_ent = -1, float confidence = 1){
+    assert(n < N);
+    r[n++] = {pf_addr, source_ent, confidence};
+  }
+};
+
+// ----------------------------------------------------------------------------
+// The candidates a member generated since the hybrid last drained it. The
+// fields are kept in separate arrays so the duplicate check runs over the
+// addresses alone
+// ----------------------------------------------------------------------------
+class PF_BATCH {
+  public:
+    std::vector<uint64_t> pf_addr;
+    std::vector<long> source_ent;
+    std::vector<float> confidence;
+
+    uint32_t size() const { return pf_addr.size(); }
+
+    void push(uint64_t addr, long ent, float conf){
+      pf_addr.push_back(addr);
+      source_ent.push_back(ent);
+      confidence.push_back(conf);
+    }
+
+    void append(const PF_RECORD *records, uint32_t count){
+      pf_addr.reserve(pf_addr.size() + count);
+      source_ent.reserve(source_ent.size() + count);
+      confidence.reserve(confidence.size() + count);
+      for(uint32_t a = 0; a < count; a++)
+        push(records[a].pf_addr, records[a].source_ent, records[a].confidence);
+    }
+
+    void clear(){
+      pf_addr.clear();
+      source_ent.clear();
+      confidence.clear();
+    }
+
+    // Keeps the first record of every block, in order, and returns the
+    // number removed. The inner scan has no early exit so it vectorizes
+    uint32_t dedup(uint32_t log2_block_size){
+      uint32_t kept = 0;
+      for(uint32_t a = 0; a < pf_addr.size(); a++){
+        uint64_t block = pf_addr[a] >> log2_block_size;
+        bool seen = false;
+        for(uint32_t b = 0; b < kept; b++)
+          seen |= (pf_addr[b] >> log2_block_size) == block;
+        if(seen)
+          continue;
+        pf_addr[kept] = pf_addr[a];
+        source_ent[kept] = source_ent[a];
+        confidence[kept] = confidence[a];
+        kept++;
+      }
+      uint32_t removed = pf_addr.size() - kept;
+      pf_addr.resize(kept);
+      source_ent.resize(kept);
+      confidence.resize(kept);
+      return removed;
+    }
+};
+
+#endif
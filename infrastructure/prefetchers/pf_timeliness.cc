@@ -0,0 +1,84 @@
+#include "pf_timeliness.h"
+#include <cassert>
+
+using namespace std;
+
+// Weight of a new lead time in the running average
+#define TIMELINESS_AVG_SHIFT 4
+
+static uint32_t log2_bucket(uint64_t cycles){
+  uint32_t b = cycles == 0 ? 0 : 64 - __builtin_clzll(cycles);
+  return b < TIMELINESS_BUCKETS ? b : TIMELINESS_BUCKETS - 1;
+}
+
+PF_TIMELINESS::PF_TIMELINESS() : num_pfs(0), mask(0){
+  for(uint32_t a = 0; a < TIMELINESS_MAX_PFS; a++){
+    on_time[a] = late[a] = 0;
+    avg_lead[a] = 0;
+    for(uint32_t b = 0; b < TIMELINESS_BUCKETS; b++)
+      lead_hist[a][b] = late_hist[a][b] = 0;
+  }
+}
+
+void PF_TIMELINESS::configure(uint32_t n_pfs, uint32_t log2_entries){
+  assert(n_pfs <= TIMELINESS_MAX_PFS);
+  num_pfs = n_pfs;
+  table.assign(1ull << log2_entries, ENTRY());
+  mask = table.size() - 1;
+}
+
+PF_TIMELINESS::ENTRY *PF_TIMELINESS::find(uint64_t block){
+  ENTRY &e = table[(block ^ (block >> 11)) & mask];
+  return e.valid && e.block == block ? &e : NULL;
+}
+
+void PF_TIMELINESS::issued(uint64_t block, uint32_t puid, uint64_t generated){
+  assert(puid < num_pfs);
+  table[(block ^ (block >> 11)) & mask] = {block, generated, 0, puid, true, false};
+}
+
+void PF_TIMELINESS::demand(uint64_t block, uint64_t cycle, bool cache_hit){
+  ENTRY *e = find(block);
+  if(e == NULL || e->demanded)
+    return;
+
+  uint64_t lead = cycle - e->generated;
+  lead_hist[e->puid][log2_bucket(lead)]++;
+  if(avg_lead[e->puid] == 0)
+    avg_lead[e->puid] = lead;
+  else
+    avg_lead[e->puid] += (lead - avg_lead[e->puid]) / (1 << TIMELINESS_AVG_SHIFT);
+
+  //A late one stays until its fill measures by how much
+  if(e->filled || cache_hit){
+    on_time[e->puid]++;
+    e->valid = false;
+  }else{
+    late[e->puid]++;
+    e->demanded = cycle;
+  }
+}
+
+void PF_TIMELINESS::fill(uint64_t block, uint64_t cycle){
+  ENTRY *e = find(block);
+  if(e == NULL)
+    return;
+  if(e->demanded){
+    late_hist[e->puid][log2_bucket(cycle - e->demanded)]++;
+    e->valid = false;
+  }else{
+    e->filled = true;
+  }
+}
+
+void PF_TIMELINESS::register_stats(STATS_REGISTRY &stats, const string &prefix){
+  stats.add_array(prefix + "on_time", on_time, num_pfs);
+  stats.add_array(prefix + "late", late, num_pfs);
+  stats.add_array(prefix + "avg_lead", avg_lead, num_pfs);
+  //Members are numbered from 1, as in the telemetry
+  for(uint32_t a = 0; a < num_pfs; a++){
+    string pf = to_string(a + 1);
+    stats.add_array(prefix + "lead_hist." + pf, lead_hist[a], TIMELINESS_BUCKETS);
+    stats.add_array(prefix + "late_hist." + pf, late_hist[a], TIMELINESS_BUCKETS);
+  }
+}
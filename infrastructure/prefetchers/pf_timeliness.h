@@ -0,0 +1,74 @@
+#ifndef PF_TIMELINESS_H
+#define PF_TIMELINESS_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "stats_registry.h"
+
+// Upper bound on hybrid members, matches MAX_NUM_SUBPREFS in prefetch_buffer.h
+#define TIMELINESS_MAX_PFS 4
+
+// Log2 buckets of the histograms, the last one also takes everything longer
+#define TIMELINESS_BUCKETS 16
+
+// ----------------------------------------------------------------------------
+// How early each member's prefetches arrive. Every prefetch issued to the L1I
+// is followed in a direct-mapped table until its first demand, or until
+// another block takes its slot. Its lead time is the cycles from the
+// candidate's generation (PF_BUFFER_ENTRY::timestamp) to that demand. A
+// prefetch demanded before its fill is late, by the cycles from the demand to
+// the fill. Both are kept as log2 histograms per member. The lead time is
+// also kept as a running average, which says how long after its generation
+// a member's candidate is still worth issuing.
+// ----------------------------------------------------------------------------
+class PF_TIMELINESS {
+  public:
+    uint32_t num_pfs;
+
+    uint64_t on_time[TIMELINESS_MAX_PFS];     // filled before their first demand
+    uint64_t late[TIMELINESS_MAX_PFS];        // demanded before their fill
+    uint64_t lead_hist[TIMELINESS_MAX_PFS][TIMELINESS_BUCKETS];
+    uint64_t late_hist[TIMELINESS_MAX_PFS][TIMELINESS_BUCKETS];
+    float avg_lead[TIMELINESS_MAX_PFS];       // 0 until a prefetch is demanded
+
+    PF_TIMELINESS();
+
+    // Follows up to 2^log2_entries prefetches at once
+    void configure(uint32_t num_pfs, uint32_t log2_entries);
+
+    // A prefetch the L1I accepted, generated by member puid at that cycle
+    void issued(uint64_t block, uint32_t puid, uint64_t generated);
+
+    // Every L1I demand access
+    void demand(uint64_t block, uint64_t cycle, bool cache_hit);
+
+    // Every prefetch fill of the L1I
+    void fill(uint64_t block, uint64_t cycle);
+
+    // Cycles after its generation past which a candidate of member puid has
+    // most likely been demanded already, factor times its average lead time.
+    // 0 while there is no estimate
+    uint64_t useful_window(uint32_t puid, float factor) const {
+      return (uint64_t)(avg_lead[puid] * factor);
+    }
+
+    void register_stats(STATS_REGISTRY &stats, const std::string &prefix);
+
+  private:
+    struct ENTRY {
+      uint64_t block;
+      uint64_t generated;
+      uint64_t demanded;    // cycle of the first demand, 0 before it
+      uint32_t puid;
+      bool valid;
+      bool filled;
+    };
+
+    std::vector<ENTRY> table;
+    uint64_t mask;
+
+    ENTRY *find(uint64_t block);
+};
+
+#endif
@@ -0,0 +1,129 @@
+#include "ppf_tuner.h"
+#include <algorithm>
+#include <cassert>
+#include <cstdlib>
+
+using namespace std;
+
+PPF_TUNER::PPF_TUNER() : num_pfs(0), epochs(0), kept(0), reverted(0), state(TUNER_MEASURE),
+  accesses(0), misses(0), baseline(0), cur(0), delta(0), min_step(1), bound(0), file(NULL){
+  for(uint32_t a = 0; a < TUNER_MAX_PFS; a++)
+    thresh[a] = l2_thresh[a] = 0;
+}
+
+PPF_TUNER::~PPF_TUNER(){
+  if(file != NULL)
+    fclose(file);
+}
+
+void PPF_TUNER::configure(uint32_t n_pfs, const int *start, const int *l2_start,
+                          int start_step, int smallest_step, int max_abs, const char *default_log){
+  assert(n_pfs <= TUNER_MAX_PFS);
+  assert(smallest_step > 0 && start_step >= smallest_step);
+  num_pfs = n_pfs;
+  min_step = smallest_step;
+  bound = max_abs;
+  for(uint32_t a = 0; a < num_pfs; a++){
+    thresh[a] = start[a];
+    l2_thresh[a] = l2_start[a];
+  }
+  for(uint32_t c = 0; c < num_pfs * 2; c++){
+    step[c] = start_step;
+    dir[c] = 1;
+  }
+
+  path = default_log;
+  if(const char *val = getenv("HYBRID_TUNER_LOG"))
+    path = val;
+  if(path.empty())
+    return;
+
+  file = fopen(path.c_str(), "w");
+  if(file == NULL){
+    printf("Could not open %s, not logging the tuner\n", path.c_str());
+    return;
+  }
+  fprintf(file, "epoch,cycle,miss_rate,decision,member,level");
+  for(uint32_t a = 0; a < num_pfs; a++)
+    fprintf(file, ",thresh%u,l2_thresh%u", a + 1, a + 1);
+  fprintf(file, "\n");
+}
+
+// ----------------------------------------------------------------------------
+// Moves the current coordinate by its step, within the bounds and the L2 <=
+// L1 ordering. Returns false, and flips the direction, if it cannot move
+// ----------------------------------------------------------------------------
+bool PPF_TUNER::try_move(){
+  uint32_t m = cur / 2;
+  int lo = cur % 2 ? -bound : l2_thresh[m];
+  int hi = cur % 2 ? thresh[m] : bound;
+  int &v = value(cur);
+  int next = min(max(v + dir[cur] * step[cur], lo), hi);
+  delta = next - v;
+  if(delta == 0){
+    dir[cur] = -dir[cur];
+    return false;
+  }
+  v = next;
+  return true;
+}
+
+int PPF_TUNER::epoch(uint64_t cycle){
+  double miss_rate = accesses == 0 ? 0.0 : (double)misses / accesses;
+  accesses = 0;
+  misses = 0;
+  epochs++;
+
+  if(num_pfs == 0)
+    return -1;
+
+  if(state == TUNER_TRIAL){
+    uint32_t judged = cur;
+    cur = (cur + 1) % (num_pfs * 2);
+    if(miss_rate < baseline){
+      kept++;
+      baseline = miss_rate;
+      log(cycle, miss_rate, "kept", judged);
+    }else{
+      //Undo, then measure the old thresholds again before the next move
+      reverted++;
+      value(judged) -= delta;
+      dir[judged] = -dir[judged];
+      step[judged] = max(step[judged] / 2, min_step);
+      state = TUNER_MEASURE;
+      log(cycle, miss_rate, "reverted", judged);
+      return judged / 2;
+    }
+  }else{
+    baseline = miss_rate;
+    log(cycle, miss_rate, "measured", cur);
+  }
+
+  //A coordinate at its bound gives its turn to the next one
+  for(uint32_t tries = 0; tries < num_pfs * 2; tries++){
+    if(try_move()){
+      state = TUNER_TRIAL;
+      return cur / 2;
+    }
+    cur = (cur + 1) % (num_pfs * 2);
+  }
+  state = TUNER_MEASURE;
+  return -1;
+}
+
+void PPF_TUNER::log(uint64_t cycle, double miss_rate, const char *decision, uint32_t c){
+  if(file == NULL)
+    return;
+  fprintf(file, "%lu,%lu,%f,%s,%u,%s", epochs, cycle, miss_rate, decision, c / 2 + 1, c % 2 ? "l2" : "l1");
+  for(uint32_t a = 0; a < num_pfs; a++)
+    fprintf(file, ",%d,%d", thresh[a], l2_thresh[a]);
+  fprintf(file, "\n");
+}
+
+void PPF_TUNER::register_stats(STATS_REGISTRY &stats, const string &prefix){
+  stats.add_counter(prefix + "epochs", &epochs);
+  stats.add_counter(prefix + "kept", &kept);
+  stats.add_counter(prefix + "reverted", &reverted);
+  stats.add_array(prefix + "thresh", thresh, num_pfs);
+  stats.add_array(prefix + "l2_thresh", l2_thresh, num_pfs);
+}
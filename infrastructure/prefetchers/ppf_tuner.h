@@ -0,0 +1,73 @@
+#ifndef PPF_TUNER_H
+#define PPF_TUNER_H
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include "stats_registry.h"
+
+// Upper bound on hybrid members, matches MAX_NUM_SUBPREFS in prefetch_buffer.h
+#define TUNER_MAX_PFS 4
+
+// ----------------------------------------------------------------------------
+// Online hill climbing of each member's PPF thresholds. Every epoch either
+// measures the L1I demand miss rate of the current thresholds or judges the
+// move tried during it: a move that lowered the miss rate is kept, any other
+// is undone, and that threshold's direction flips and its step halves. The
+// L1 and L2 thresholds of all members are tried in turn, with the L2
+// threshold kept at or below the L1 one.
+// ----------------------------------------------------------------------------
+class PPF_TUNER {
+  public:
+    uint32_t num_pfs;
+    int thresh[TUNER_MAX_PFS];
+    int l2_thresh[TUNER_MAX_PFS];
+
+    uint64_t epochs;
+    uint64_t kept;
+    uint64_t reverted;
+
+    PPF_TUNER();
+    ~PPF_TUNER();
+
+    // Starts from the given thresholds and keeps them within +-bound.
+    // HYBRID_TUNER_LOG overrides default_log, empty writes no trajectory
+    void configure(uint32_t num_pfs, const int *thresh, const int *l2_thresh,
+                   int step, int min_step, int bound, const char *default_log);
+
+    // Counts one L1I demand access
+    void access(bool cache_hit){
+      accesses++;
+      misses += !cache_hit;
+    }
+
+    // Closes an epoch, returns the member whose thresholds changed or -1
+    int epoch(uint64_t cycle);
+
+    void register_stats(STATS_REGISTRY &stats, const std::string &prefix);
+
+  private:
+    enum TUNER_STATE { TUNER_MEASURE, TUNER_TRIAL };
+
+    TUNER_STATE state;
+    uint64_t accesses;
+    uint64_t misses;
+    double baseline;
+
+    // Coordinate c is member c/2's L1 (even c) or L2 (odd c) threshold
+    uint32_t cur;
+    int step[TUNER_MAX_PFS * 2];
+    int dir[TUNER_MAX_PFS * 2];
+    int delta;
+    int min_step;
+    int bound;
+
+    std::string path;
+    FILE *file;
+
+    int &value(uint32_t c){ return c % 2 ? l2_thresh[c / 2] : thresh[c / 2]; }
+    bool try_move();
+    void log(uint64_t cycle, double miss_rate, const char *decision, uint32_t c);
+};
+
+#endif
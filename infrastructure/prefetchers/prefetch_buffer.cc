@@ -7,6 +7,43 @@ const bool ALLOC_ON = false;
 
 const float comparison_metric = 0.15;
 
+// PF_BUFF_SIZE and EPOCH_SIZE unless the hybrid's runtime config changes them
+uint32_t pf_buff_size = PF_BUFF_SIZE;
+uint64_t pf_epoch_size = EPOCH_SIZE;
+
+// Splits the PQ slots by pf_slot_weight instead of round-robin, set by the
+// hybrid. The weights are the members' recent utility, all zero splits evenly
+bool pf_utility_alloc = false;
+float pf_slot_weight[MAX_NUM_SUBPREFS];
+
+// Issues the blocks the most members buffered first instead of round-robin,
+// set by the hybrid. Blocks fewer than pf_vote_quorum members buffered are
+// dropped once their vote comes up
+bool pf_voters = false;
+uint32_t pf_vote_quorum = 1;
+// Issued prefetches by the number of members that voted for them, and blocks
+// dropped under the quorum
+uint64_t pf_vote_issued[MAX_NUM_SUBPREFS + 1];
+uint64_t pf_vote_rejected = 0;
+
+// Candidates each member lost in the buffer: dropped on arrival at a full
+// buffer, pushed out of it by a newer one while pf_replace_oldest is set
+// (the hybrid sets it while the PQ stays full), or found in the shadow cache
+bool pf_replace_oldest = false;
+uint64_t pf_full_drops[MAX_NUM_SUBPREFS];
+uint64_t pf_aged_out[MAX_NUM_SUBPREFS];
+uint64_t pf_redundant_drops[MAX_NUM_SUBPREFS];
+
+// Schedules by timeliness, set by the hybrid with each member's useful window
+// and lead time as of pf_timely_now. A candidate older than its member's
+// window is dropped as too late (a window of 0 keeps them all) and counted in
+// pf_late_drops, and the member whose oldest candidate is due first goes first
+bool pf_timely = false;
+uint64_t pf_timely_now = 0;
+uint64_t pf_timely_window[MAX_NUM_SUBPREFS];
+uint64_t pf_timely_lead[MAX_NUM_SUBPREFS];
+uint64_t pf_late_drops[MAX_NUM_SUBPREFS];
+
 // Needed to compare two buffer entries for iteration
 bool operator== ( const PF_BUFFER_ENTRY &pfb1, const PF_BUFFER_ENTRY &pfb2) {
 
@@ -16,6 +53,156 @@ bool operator== ( const PF_BUFFER_ENTRY &pfb1, const PF_BUFFER_ENTRY &pfb2) {
   return shifted_addr1 == shifted_addr2;
 }
 
+// ----------------------------------------------------------------------------
+// One block's votes for the cycle, in an open-addressed table that is not
+// cleared between cycles: a slot whose stamp is not the cycle's is empty
+// ----------------------------------------------------------------------------
+struct VOTE_SLOT {
+  uint64_t block;
+  uint64_t stamp;
+  uint32_t members;   // bit per member that buffered the block
+  uint32_t member;    // member and position of the block's first entry
+  uint32_t pos;
+  bool remove;        // issued or dropped this cycle
+};
+
+static vector<VOTE_SLOT> vote_table;
+static uint64_t vote_stamp = 0;
+
+static uint32_t vote_slot(uint64_t block){
+  uint32_t mask = vote_table.size() - 1;
+  uint32_t i = (block * 0x9E3779B97F4A7C15ull) >> 40 & mask;
+  while(vote_table[i].stamp == vote_stamp && vote_table[i].block != block)
+    i = (i + 1) & mask;
+  return i;
+}
+
+// ----------------------------------------------------------------------------
+// Drops the candidates that outlived their member's useful window, oldest
+// first, and orders the members by when their oldest candidate is expected to
+// be demanded. Members without an estimate yet keep their place behind the
+// others
+// ----------------------------------------------------------------------------
+static void timely_schedule(deque<PF_BUFFER_ENTRY> *pf_buffer, uint32_t *num_buff, uint32_t num_subprefs,
+                            deque<uint32_t> &order){
+  uint64_t due[MAX_NUM_SUBPREFS];
+  for(uint32_t a = 0; a < num_subprefs; a++){
+    uint64_t window = pf_timely_window[a];
+    while(window && !pf_buffer[a].empty() && pf_timely_now - pf_buffer[a].front().timestamp > window){
+      pf_buffer[a].pop_front();
+      num_buff[a]--;
+      pf_late_drops[a]++;
+    }
+    due[a] = pf_buffer[a].empty() || !window ? UINT64_MAX : pf_buffer[a].front().timestamp + pf_timely_lead[a];
+  }
+
+  order.clear();
+  for(uint32_t a = 0; a < num_subprefs; a++)
+    order.push_back(a);
+  stable_sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b){ return due[a] < due[b]; });
+}
+
+// ----------------------------------------------------------------------------
+// Consensus arbitration: every buffered entry votes for its block, at most
+// once per member. The blocks are issued by number of votes, the oldest
+// first among equals, as the entry of the first member (in subpref_order) to
+// buffer them with pref_overlap_id set for all voters. Issued blocks and
+// those hitting in the shadow cache are removed from every buffer, the rest
+// wait for the next cycle, except those under pf_vote_quorum. With PPF_MERGE
+// the hybrid then prefetches a block with several votes if any voter's PPF
+// accepts it. Linear in the number of buffered entries
+// ----------------------------------------------------------------------------
+static deque<PF_BUFFER_ENTRY> vote_prefetches(int num_to_fetch, SHADOW_CACHE *sc, deque<PF_BUFFER_ENTRY> *pf_buffer,
+                                              uint32_t *num_buff, uint32_t num_subprefs, const deque<uint32_t> &order){
+  deque<PF_BUFFER_ENTRY> prefetches;
+  if(num_to_fetch <= 0)
+    return prefetches;
+
+  uint32_t total = 0;
+  for(uint32_t a = 0; a < num_subprefs; a++)
+    total += pf_buffer[a].size();
+  if(vote_table.size() < 2 * total){
+    uint32_t size = 64;
+    while(size < 2 * total)
+      size *= 2;
+    vote_table.assign(size, VOTE_SLOT());
+  }
+  vote_stamp++;
+
+  // Count the votes, and the slots in the order their blocks were first seen
+  vector<uint32_t> seen;
+  vector<uint32_t> entry_slot;
+  seen.reserve(total);
+  entry_slot.reserve(total);
+  for(uint32_t a = 0; a < num_subprefs; a++){
+    uint32_t b = order.at(a);
+    for(uint32_t c = 0; c < pf_buffer[b].size(); c++){
+      uint64_t block = pf_buffer[b][c].pf_addr >> LOG2_BLOCK_SIZE;
+      uint32_t i = vote_slot(block);
+      VOTE_SLOT &v = vote_table[i];
+      if(v.stamp != vote_stamp){
+        v.block = block;
+        v.stamp = vote_stamp;
+        v.members = 0;
+        v.member = b;
+        v.pos = c;
+        v.remove = false;
+        seen.push_back(i);
+      }
+      v.members |= 1 << b;
+      entry_slot.push_back(i);
+    }
+  }
+
+  uint32_t decided = 0;
+  for(int votes = num_subprefs; votes > 0; votes--){
+    for(uint32_t i : seen){
+      VOTE_SLOT &v = vote_table[i];
+      if(__builtin_popcount(v.members) != votes)
+        continue;
+      if((uint32_t)votes < pf_vote_quorum){
+        v.remove = true;
+        decided++;
+        pf_vote_rejected++;
+        continue;
+      }
+      if((int)prefetches.size() == num_to_fetch)
+        continue;
+
+      PF_BUFFER_ENTRY pf = pf_buffer[v.member][v.pos];
+      bool hit = 0;
+      bool pre = 0;
+      if(sc != NULL)
+        (*sc).access_cache(pf.pf_addr, &hit, &pre, NULL, v.member, NULL, 0, NULL, NULL, ACCESS_PROBE);
+      v.remove = true;
+      decided++;
+      if(hit || pre){
+        pf_redundant_drops[v.member]++;
+        continue;
+      }
+      pf.pref_overlap_id |= v.members;
+      prefetches.push_back(pf);
+      pf_vote_issued[votes]++;
+    }
+  }
+
+  if(decided == 0)
+    return prefetches;
+
+  // Take the decided blocks out of every buffer, in the same order as counted
+  uint32_t e = 0;
+  for(uint32_t a = 0; a < num_subprefs; a++){
+    uint32_t b = order.at(a);
+    deque<PF_BUFFER_ENTRY> kept;
+    for(uint32_t c = 0; c < pf_buffer[b].size(); c++)
+      if(!vote_table[entry_slot[e++]].remove)
+        kept.push_back(pf_buffer[b][c]);
+    pf_buffer[b].swap(kept);
+    num_buff[b] = pf_buffer[b].size();
+  }
+  return prefetches;
+}
+
 // ----------------------------------------------------------------------------
 // Generates and returns a deque of (up to) num_to_fetch prefetches from the 
 // subprefetchers' buffers. May or may 
@@ -29,6 +216,9 @@ deque<PF_BUFFER_ENTRY> PREFETCH_BUFFER::generate_prefetches(int num_to_fetch, SH
   // The deque to return 
   deque<PF_BUFFER_ENTRY> prefetches;
 
+  if(pf_timely)
+    timely_schedule(pf_buffer, num_buff, num_subprefs, subpref_order);
+
   // Number of prefetches grabbed so far, 
   int num_prefetched = 0;
 
@@ -41,12 +231,22 @@ deque<PF_BUFFER_ENTRY> PREFETCH_BUFFER::generate_prefetches(int num_to_fetch, SH
   if(!tot_entries)
     return prefetches;
 
+  if(pf_voters){
+    uint8_t has_pf = 0;
+    for(uint32_t a = 0; a < num_subprefs; a++)
+      if(num_buff[a] != 0)
+        has_pf |= (1 << a);
+    pf_gen_scenario[has_pf]++;
+    return vote_prefetches(num_to_fetch, sc, pf_buffer, num_buff, num_subprefs, subpref_order);
+  }
+
 //else...
 #ifdef ROUND_ROBIN
 
   // While we have prefetche slots to allocate, and prefetch
   // entries to choose from
   int attempt_pf = 0;
+  bool alloc_on = ALLOC_ON || pf_utility_alloc;
   vector<int>allocs = allocate_prefetches(num_to_fetch);
   vector<int> n_pf;
 
@@ -66,6 +266,11 @@ deque<PF_BUFFER_ENTRY> PREFETCH_BUFFER::generate_prefetches(int num_to_fetch, SH
   
   while(num_prefetched < num_to_fetch && tot_entries != 0){// && attempt_pf < (num_to_fetch * 2)) {
 
+    // Set if a buffer was popped this round. A round without one means every
+    // member with entries used its allocation, the rest of the slots are free
+    // for all
+    bool popped = false;
+
     // For each subprefetcher's deque...
     for(uint32_t i = 0; i < num_subprefs; i++) {
   
@@ -74,7 +279,8 @@ deque<PF_BUFFER_ENTRY> PREFETCH_BUFFER::generate_prefetches(int num_to_fetch, SH
       int b = subpref_order.at(i);
       attempt_pf++; 
       // if subprefetcher's deque has at least one entry... 
-      if(!pf_buffer[b].empty() && (n_pf[b] < allocs[b] || !ALLOC_ON)) {
+      if(!pf_buffer[b].empty() && (n_pf[b] < allocs[b] || !alloc_on)) {
+        popped = true;
     
         // Check the entry is not already in the deque of prefetches
         if(find(prefetches.begin(), prefetches.end(), pf_buffer[b].front()) == prefetches.end()) {
@@ -96,7 +302,6 @@ deque<PF_BUFFER_ENTRY> PREFETCH_BUFFER::generate_prefetches(int num_to_fetch, SH
             //Add it to the history for confidence value
             if(!hit && !pre){
               uint64_t e_tag = 0;
-              (*sc).access_cache(pf_buffer[b].front().pf_addr, &hit, &pre, NULL, b, NULL, 0, NULL, NULL, ACCESS_PROBE);
         
               if(METRICS_ON || ALLOC_ON){
                 (*sc).access_cache(pf_buffer[b].front().pf_addr, NULL, NULL, NULL, NULL, &e_tag, 0, NULL, NULL, ACCESS_PREFETCH);
@@ -118,7 +323,6 @@ deque<PF_BUFFER_ENTRY> PREFETCH_BUFFER::generate_prefetches(int num_to_fetch, SH
               }
 
               //assert(pf_history[i].size() <= MAX_ACC_VAL);
-              n_pf[b]++;
             }
           }
           
@@ -138,6 +342,7 @@ deque<PF_BUFFER_ENTRY> PREFETCH_BUFFER::generate_prefetches(int num_to_fetch, SH
 
             // Got one! 
             num_prefetched++;
+            n_pf[b]++;
           }
           else { // hit in the cache! We can drop it...
             
@@ -151,15 +356,17 @@ deque<PF_BUFFER_ENTRY> PREFETCH_BUFFER::generate_prefetches(int num_to_fetch, SH
             // It was in the shadow cache already. Simply discard it. 
             pf_buffer[b].pop_front();
             num_buff[b]--;
+            pf_redundant_drops[b]++;
           }
         }
         else { // hit in the prefetch deque! We can drop it.
          
           deque<PF_BUFFER_ENTRY>::iterator it = find(prefetches.begin(), prefetches.end(), pf_buffer[b].front()); 
 
+          //pref_overlap_id is a mask of the members that asked for the block
           if(it->pref_unit_id != b){
-            it->pref_overlap_id |= b;
-            assert(it->pref_unit_id != it->pref_overlap_id);
+            it->pref_overlap_id |= 1 << b;
+            assert(it->pref_overlap_id != (1 << it->pref_unit_id));
           }
           
           // Debug
@@ -180,6 +387,9 @@ deque<PF_BUFFER_ENTRY> PREFETCH_BUFFER::generate_prefetches(int num_to_fetch, SH
     tot_entries = 0;
     for(uint32_t i = 0; i < num_subprefs; i++)
       tot_entries += num_buff[i];
+
+    if(!popped)
+      alloc_on = false;
   }
 
   // Debug 
@@ -208,134 +418,6 @@ deque<PF_BUFFER_ENTRY> PREFETCH_BUFFER::generate_prefetches(int num_to_fetch, SH
 //    assert(false);
 #endif
 
-#ifdef VOTERS
-  //Find prefetches that are in 2 or more prefetch buffers
-  map<uint64_t, int> pf_counts;
-  vector<PF_BUFFER_ENTRY> pf;
-  for(uint32_t a = 0; a < num_subprefs; a++){
-    int b = subpref_order.at(a);
-    if(!pf_buffer[b].empty()) {
-      for(int c = 0; c < pf_buffer[b].size(); c++){
-        if(pf_counts.find(pf_buffer[b][c].pf_addr) == pf_counts.end())
-          pf_counts[pf_buffer[b][c].pf_addr] = 1;
-        else
-          pf_counts[pf_buffer[b][c].pf_addr]++;
-      }
-    } 
-  } 
- 
-  vector<uint64_t> removal; 
-  for(auto ent : pf_counts){
-    if(prefetches.size() == num_to_fetch)
-      break;
-    if(ent.second >= 2){
-      for(int a = 0; a < prefetches.size(); a++)
-        if(prefetches[a].pf_addr == ent.first)
-          continue;
-      bool hit = 0; 
-      bool pre = 0;
-      if(sc != NULL) {
-        (*sc).access_cache(ent.first, &hit, &pre, 0, NULL, NULL, ACCESS_PROBE);
-      } 
-
-      if(!hit && !pre) {
-        bool found = false;
-        for(uint32_t a = 0; a < num_subprefs; a++){
-          for(int b = 0; b < pf_buffer[a].size(); b++){
-            if(pf_buffer[a][b].pf_addr == ent.first){
-              prefetches.push_back(pf_buffer[a][b]);
-              //prefetches.push_back(ent.first);
-              found = true;
-              break;
-            }
-            if(found)
-              break;
-          }
-          if(found)
-            break;
-        }
-
-        // Pop out the front buffer entry and add it to deque 
-        removal.push_back(ent.first);
-
-        // Got one! 
-        num_prefetched++;
-      }
-      else { // hit in the cache! We can drop it...
-
-        // It was in the shadow cache already. Simply discard it. 
-        removal.push_back(ent.first);
-      }
-    }
-  }
-
-  if(prefetches.size() < num_to_fetch){
-    for(auto ent : pf_counts){
-      if(prefetches.size() == num_to_fetch)
-        break;
-      if(ent.second >= 1){
-        for(int a = 0; a < prefetches.size(); a++)
-          if(prefetches[a].pf_addr == ent.first)
-            continue;
-
-        bool hit = 0; 
-        bool pre = 0;
-        if(sc != NULL) {
-          (*sc).access_cache(ent.first, &hit, &pre, 0, NULL, NULL, ACCESS_PROBE);
-        } 
-
-        if(!hit && !pre) {
-
-          // Pop out the front buffer entry and add it to deque 
-          bool found = false;
-          for(uint32_t a = 0; a < num_subprefs; a++){
-
-            if(found)
-              break;
-
-            for(int b = 0; b < pf_buffer[a].size(); b++){
-              if(pf_buffer[a][b].pf_addr == ent.first){
-                prefetches.push_back(pf_buffer[a][b]);
-                //prefetches.push_back(ent.first);
-                found = true;
-                break;
-              }
-              if(found)
-                break;
-            }
-          } 
-          removal.push_back(ent.first);
-
-          // Got one! 
-          num_prefetched++;
-        }
-        else { // hit in the cache! We can drop it...
-
-          // It was in the shadow cache already. Simply discard it. 
-          removal.push_back(ent.first);
-        }
-      }
-    }
-  }
-
-  if(removal.size() == 0)
-    return prefetches;
-
-  for(uint32_t a = 0; a < num_subprefs; a++){
-    int idx = 0;
-    while(idx < pf_buffer[a].size()){
-      if(find(removal.begin(), removal.end(), pf_buffer[a][idx].pf_addr) != removal.end()){
-        pf_buffer[a].erase(pf_buffer[a].begin() + idx);
-        num_buff[a]--;
-      }else{
-        idx++;
-      }
-    }
-    //printf("%d\n", idx);
-  }
-  return prefetches; 
-#endif
-
 }
 
 // ----------------------------------------------------------------------------
@@ -353,15 +435,22 @@ void PREFETCH_BUFFER::add_pf_entry(uint64_t ip, uint64_t base_addr, uint64_t pf_
 
   // Add it to the right buffer based on puid value
   // while ensuring the deque isn't overfilled
-  if(num_buff[puid] < PF_BUFF_SIZE) {
+  if(num_buff[puid] < pf_buff_size) {
     pf_buffer[puid].push_back(pfb_entry);
     
     // Increment buffer size tracker
     num_buff[puid]++;
   }
-  // Else, buffer was full...
-  else { 
-    // do nothing. It simply doesn't get added
+  // Else, buffer was full. Under a saturated PQ the oldest entry would be
+  // late anyway, so it makes room for the new one
+  else if(pf_replace_oldest) {
+    pf_buffer[puid].pop_front();
+    pf_buffer[puid].push_back(pfb_entry);
+    pf_aged_out[puid]++;
+  }
+  // Otherwise it simply doesn't get added
+  else {
+    pf_full_drops[puid]++;
   }
 }
 
@@ -442,9 +531,79 @@ void PREFETCH_BUFFER::upgrade_prefetchers(vector<uint32_t> new_order) {
 
 }
 
+// ----------------------------------------------------------------------------
+// Splits num_to_fetch slots over the members with buffered prefetches in
+// proportion to pf_slot_weight, by water-filling: a member is never given
+// more slots than it has entries, and what it cannot use goes to the others
+// by their weights. Leftover fractions go to the largest remainders. A member
+// with no weight gets no slots here, only those left once the others are
+// done (see generate_prefetches)
+// ----------------------------------------------------------------------------
+static vector<int> utility_allocation(int num_to_fetch, const uint32_t *num_buff, uint32_t num_subprefs){
+  vector<int> alloc(num_subprefs, 0);
+  vector<bool> open(num_subprefs, false);
+  bool weighted = false;
+  for(uint32_t a = 0; a < num_subprefs; a++){
+    open[a] = num_buff[a] > 0;
+    weighted |= open[a] && pf_slot_weight[a] > 0;
+  }
+
+  int left = num_to_fetch;
+  while(left > 0){
+    float total = 0;
+    for(uint32_t a = 0; a < num_subprefs; a++)
+      if(open[a])
+        total += weighted ? pf_slot_weight[a] : 1;
+    if(total <= 0)
+      break;
+
+    // Give every open member its share, capping those that run out of entries
+    bool capped = false;
+    int given = 0;
+    vector<float> frac(num_subprefs, -1);
+    for(uint32_t a = 0; a < num_subprefs; a++){
+      if(!open[a])
+        continue;
+      float share = left * (weighted ? pf_slot_weight[a] : 1) / total;
+      int room = num_buff[a] - alloc[a];
+      if(share >= room){
+        alloc[a] += room;
+        given += room;
+        open[a] = false;
+        capped = true;
+      }else{
+        alloc[a] += (int)share;
+        given += (int)share;
+        frac[a] = share - (int)share;
+      }
+    }
+    left -= given;
+    if(capped)
+      continue;
+
+    // Nobody capped, hand out what the rounding left
+    while(left > 0){
+      int best = -1;
+      for(uint32_t a = 0; a < num_subprefs; a++)
+        if(frac[a] > 0 && (best < 0 || frac[a] > frac[best]))
+          best = a;
+      if(best < 0)
+        break;
+      alloc[best]++;
+      frac[best] = -1;
+      left--;
+    }
+    break;
+  }
+  return alloc;
+}
+
 //Allocate prefetches based on the number of prefetches in a buffer
 //and the metric used to indicate a pfer is confident 
 vector<int> PREFETCH_BUFFER::allocate_prefetches(int num_to_fetch){
+  if(pf_utility_alloc)
+    return utility_allocation(num_to_fetch, num_buff, num_subprefs);
+
   vector<int> alloc(num_subprefs, 0);
   //Find the total number of prefetches waiting
   int total_pf = 0;
@@ -623,7 +782,7 @@ void PREFETCH_BUFFER::inc_epoch(){
   epoch++;
 
  //if a new epoch
-  if(epoch >= EPOCH_SIZE){
+  if(epoch >= pf_epoch_size){
 
     //Set the last epoch's final value
     for(uint32_t a = 0; a < num_subprefs; a++){
@@ -648,7 +807,7 @@ void PREFETCH_BUFFER::inc_epoch(){
 
     #ifdef EPOCH_DEBUG
     if(last_epoch_num != epoch_num){
-      printf(" HITRATE: %f EPOCH: %d ", float(last_epoch_hits)/float(EPOCH_SIZE), epoch_num);
+      printf(" HITRATE: %f EPOCH: %d ", float(last_epoch_hits)/float(pf_epoch_size), epoch_num);
       for(uint32_t pf_id = 0; pf_id < num_subprefs; pf_id++){ 
         float cov = last_epoch_hits > 0 ? float(last_epoch_pf_hit[pf_id])/float(last_epoch_hits) : float(pf_hit_count[pf_id])/float(epoch_hits);
 
@@ -0,0 +1,173 @@
+#include "priority_prefetch_buffer.h"
+#include <cassert>
+
+using namespace std;
+
+PRIORITY_PREFETCH_BUFFER::PRIORITY_PREFETCH_BUFFER() : num_subprefs(0), merged(0), stale(0), displaced(0),
+  full_drops(0), redundant(0), capacity(0), window(0), conf_cycles(0){
+  for(uint32_t a = 0; a < MAX_NUM_SUBPREFS; a++)
+    num_buff[a] = 0;
+}
+
+void PRIORITY_PREFETCH_BUFFER::configure(uint32_t n_subprefs, uint32_t cap, uint64_t win, uint64_t cycles){
+  assert(n_subprefs <= MAX_NUM_SUBPREFS && cap > 0);
+  num_subprefs = n_subprefs;
+  capacity = cap;
+  window = win;
+  conf_cycles = cycles;
+
+  slots.assign(num_subprefs * capacity, ENTRY());
+  pos.assign(num_subprefs * capacity, -1);
+  heap.clear();
+  heap.reserve(num_subprefs * capacity);
+  index.clear();
+  index.reserve(num_subprefs * capacity * 2);
+  free_slots.assign(num_subprefs, vector<uint32_t>());
+  for(uint32_t m = 0; m < num_subprefs; m++){
+    num_buff[m] = 0;
+    //Highest slot first so entries are handed out from the low end
+    for(uint32_t s = capacity; s > 0; s--)
+      free_slots[m].push_back(m * capacity + s - 1);
+  }
+}
+
+void PRIORITY_PREFETCH_BUFFER::sift_up(uint32_t i){
+  uint32_t slot = heap[i];
+  while(i > 0){
+    uint32_t parent = (i - 1) / 2;
+    if(slots[heap[parent]].key >= slots[slot].key)
+      break;
+    place(i, heap[parent]);
+    i = parent;
+  }
+  place(i, slot);
+}
+
+void PRIORITY_PREFETCH_BUFFER::sift_down(uint32_t i){
+  uint32_t slot = heap[i];
+  uint32_t n = heap.size();
+  while(true){
+    uint32_t child = 2 * i + 1;
+    if(child >= n)
+      break;
+    if(child + 1 < n && slots[heap[child + 1]].key > slots[heap[child]].key)
+      child++;
+    if(slots[heap[child]].key <= slots[slot].key)
+      break;
+    place(i, heap[child]);
+    i = child;
+  }
+  place(i, slot);
+}
+
+// ----------------------------------------------------------------------------
+// Takes a slot out of the heap and the index and returns it to its member
+// ----------------------------------------------------------------------------
+void PRIORITY_PREFETCH_BUFFER::remove(uint32_t slot){
+  uint32_t i = pos[slot];
+  uint32_t last = heap.back();
+  heap.pop_back();
+  pos[slot] = -1;
+  if(last != slot){
+    place(i, last);
+    sift_up(i);
+    sift_down(pos[last]);
+  }
+
+  index.erase(slots[slot].pf_addr >> LOG2_BLOCK_SIZE);
+  uint32_t m = slot / capacity;
+  free_slots[m].push_back(slot);
+  num_buff[m]--;
+}
+
+void PRIORITY_PREFETCH_BUFFER::sweep(uint32_t puid, uint64_t cycle){
+  for(uint32_t s = puid * capacity; s < (puid + 1) * capacity; s++){
+    if(pos[s] >= 0 && slots[s].deadline < cycle){
+      remove(s);
+      stale++;
+    }
+  }
+}
+
+void PRIORITY_PREFETCH_BUFFER::add_pf_entry(uint64_t pf_addr, uint32_t puid, uint64_t cycle, long source_ent, float confidence,
+                                            uint64_t entry_window){
+  assert(puid < num_subprefs);
+
+  auto it = index.find(pf_addr >> LOG2_BLOCK_SIZE);
+  if(it != index.end()){
+    ENTRY &e = slots[it->second];
+    merged++;
+    //Repeated by the same member, already counted
+    if(e.overlap & (1 << puid))
+      return;
+    e.overlap |= 1 << puid;
+    e.confidence += confidence;
+    e.key = key_of(e);
+    sift_up(pos[it->second]);
+    return;
+  }
+
+  ENTRY e = {pf_addr, cycle, cycle + (entry_window ? entry_window : window), source_ent, confidence, 0, puid, 1u << puid};
+  e.key = key_of(e);
+
+  if(free_slots[puid].empty())
+    sweep(puid, cycle);
+  if(free_slots[puid].empty()){
+    uint32_t lowest = puid * capacity;
+    for(uint32_t s = lowest + 1; s < (puid + 1) * capacity; s++)
+      if(slots[s].key < slots[lowest].key)
+        lowest = s;
+    if(slots[lowest].key >= e.key){
+      full_drops++;
+      return;
+    }
+    remove(lowest);
+    displaced++;
+  }
+
+  uint32_t slot = free_slots[puid].back();
+  free_slots[puid].pop_back();
+  slots[slot] = e;
+  index[pf_addr >> LOG2_BLOCK_SIZE] = slot;
+  num_buff[puid]++;
+  heap.push_back(slot);
+  pos[slot] = heap.size() - 1;
+  sift_up(heap.size() - 1);
+}
+
+deque<PF_BUFFER_ENTRY> PRIORITY_PREFETCH_BUFFER::generate_prefetches(int num_to_fetch, SHADOW_CACHE *sc, uint64_t cycle){
+  deque<PF_BUFFER_ENTRY> prefetches;
+
+  while((int)prefetches.size() < num_to_fetch && !heap.empty()){
+    uint32_t slot = heap[0];
+    ENTRY e = slots[slot];
+    remove(slot);
+
+    if(e.deadline < cycle){
+      stale++;
+      continue;
+    }
+
+    bool hit = 0;
+    bool pre = 0;
+    if(sc != NULL)
+      (*sc).access_cache(e.pf_addr, &hit, &pre, 0, NULL, NULL, ACCESS_PROBE);
+    if(hit || pre){
+      redundant++;
+      continue;
+    }
+
+    PF_BUFFER_ENTRY pf(0, 0, e.pf_addr, 0, 0, 1, 1, e.puid, e.timestamp, e.source_ent);
+    pf.pref_overlap_id = e.overlap;
+    prefetches.push_back(pf);
+  }
+  return prefetches;
+}
+
+void PRIORITY_PREFETCH_BUFFER::register_stats(STATS_REGISTRY &stats, const string &prefix){
+  stats.add_counter(prefix + "merged", &merged);
+  stats.add_counter(prefix + "stale", &stale);
+  stats.add_counter(prefix + "displaced", &displaced);
+  stats.add_counter(prefix + "full_drops", &full_drops);
+  stats.add_counter(prefix + "redundant", &redundant);
+}
@@ -0,0 +1,91 @@
+#ifndef PRIORITY_PREFETCH_BUFFER_H
+#define PRIORITY_PREFETCH_BUFFER_H
+
+#include <cstdint>
+#include <deque>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "prefetch_buffer.h"
+#include "stats_registry.h"
+
+// ----------------------------------------------------------------------------
+// Alternative to PREFETCH_BUFFER's per-member FIFOs: all members' candidates
+// sit in one indexed max-heap and are drained by priority. Each entry has a
+// confidence and a deadline (the cycle it was generated plus the window),
+// and its key is
+//
+//   confidence * conf_cycles - deadline
+//
+// so one unit of confidence is worth conf_cycles of urgency, and with equal
+// confidence the oldest entry goes first. The key does not depend on the
+// current cycle, so the heap stays ordered as time passes.
+//
+// A block already buffered by another member is merged into the existing
+// entry: its confidence adds up and the member is added to pref_overlap_id.
+// Entries past their deadline are dropped when they reach the top, and swept
+// from a member's entries when it is full. A full member then replaces its
+// lowest-key entry if the new one ranks higher.
+// ----------------------------------------------------------------------------
+class PRIORITY_PREFETCH_BUFFER {
+  public:
+    uint32_t num_subprefs;
+    uint32_t num_buff[MAX_NUM_SUBPREFS];
+
+    uint64_t merged;        // candidates folded into another member's entry
+    uint64_t stale;         // entries dropped past their deadline
+    uint64_t displaced;     // entries replaced by a higher key in a full member
+    uint64_t full_drops;    // candidates dropped by a full member
+    uint64_t redundant;     // entries dropped as hits in the shadow cache
+
+    PRIORITY_PREFETCH_BUFFER();
+
+    // capacity entries per member, each valid for window cycles
+    void configure(uint32_t num_subprefs, uint32_t capacity, uint64_t window, uint64_t conf_cycles);
+
+    // A non-zero entry_window replaces the configured one for this entry
+    void add_pf_entry(uint64_t pf_addr, uint32_t puid, uint64_t cycle, long source_ent, float confidence,
+                      uint64_t entry_window = 0);
+
+    // Pops up to num_to_fetch entries by priority, as PREFETCH_BUFFER does
+    // probing the shadow cache if there is one
+    std::deque<PF_BUFFER_ENTRY> generate_prefetches(int num_to_fetch, SHADOW_CACHE *sc, uint64_t cycle);
+
+    void register_stats(STATS_REGISTRY &stats, const std::string &prefix);
+
+  private:
+    struct ENTRY {
+      uint64_t pf_addr;
+      uint64_t timestamp;
+      uint64_t deadline;
+      long source_ent;
+      float confidence;
+      int64_t key;
+      uint32_t puid;
+      uint32_t overlap;
+    };
+
+    uint32_t capacity;
+    uint64_t window;
+    uint64_t conf_cycles;
+
+    // Member m owns slots [m * capacity, (m + 1) * capacity)
+    std::vector<ENTRY> slots;
+    std::vector<std::vector<uint32_t>> free_slots;
+
+    // Heap of slot ids, pos[slot] is its heap index or -1 when free
+    std::vector<uint32_t> heap;
+    std::vector<int32_t> pos;
+
+    // Block address -> slot
+    std::unordered_map<uint64_t, uint32_t> index;
+
+    int64_t key_of(const ENTRY &e){ return (int64_t)(e.confidence * conf_cycles) - (int64_t)e.deadline; }
+    void place(uint32_t i, uint32_t slot){ heap[i] = slot; pos[slot] = i; }
+    void sift_up(uint32_t i);
+    void sift_down(uint32_t i);
+    void remove(uint32_t slot);
+    void sweep(uint32_t puid, uint64_t cycle);
+};
+
+#endif
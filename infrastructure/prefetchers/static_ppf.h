@@ -0,0 +1,679 @@
+#ifndef STATIC_PPF_H
+#define STATIC_PPF_H
+
+// ----------------------------------------------------------------------------
+// A PPF whose feature set is fixed at compile time. Each feature is a small
+// descriptor type that knows how to compute its value from a PPF_CONTEXT,
+// how wide its weight table is (always a power of two) and how to hash a
+// value into it. STATIC_PPF takes a PPF_FEATURES<...> list of descriptors, so
+// the perceptron sum unrolls and every table index is a mask.
+//
+// The decisions, training and statistics are the same as PPF in ppf.cc for
+// the same features and table sizes; the hybrids pick one or the other with
+// a typedef and build a PPF_CONTEXT instead of a feature vector.
+//
+// Weights saturate at +-MAX_FEAT, so they are kept as int8_t in one array
+// and, when built with AVX2, a candidate's weights are fetched with a single
+// gather per eight features. score_batch decides on a whole cycle's
+// candidates at once, with the same result as calling check_filter_level on
+// each in order.
+//
+// The reject and prefetch tracking tables are set-associative, configured by
+// a PPF_TRACKING<...> type. The default is ppf.cc's direct-mapped table with
+// full tags.
+//
+// A single STATIC_PPF can also serve every member of a hybrid: the member is
+// then one of the features (PPF_SHARED_FEATURES) and each member keeps its
+// own thresholds, see set_unit_thresholds.
+// ----------------------------------------------------------------------------
+
+#include <array>
+#include <cassert>
+#include <cstdint>
+#include <cstdlib>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#include "ppf.h"
+#include "checkpoint.h"
+
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
+// Most members a shared PPF tells apart
+#define PPF_MAX_UNITS 4
+
+// Largest MAX_FEAT the int8_t weights hold
+#define STATIC_PPF_MAX_FEAT INT8_MAX
+
+// Everything the hybrid knows about a candidate when it asks the PPF
+struct PPF_CONTEXT {
+  uint64_t pf_addr;
+  uint64_t last_ip;           // as kept in ppf1.last_ip, already a block number
+  uint64_t branch_history;
+  uint64_t last_b_target;
+  uint64_t last_pf;
+  uint64_t b_type_hist;
+  uint32_t puid;              // the member that generated the candidate
+};
+
+// ----------------------------------------------------------------------------
+// Feature descriptors. TABLE_BITS sets the weight table size and index()
+// maps a feature value into it. The default hash keeps the low bits, which is
+// what PPF::get_hash's modulo does for power-of-two table sizes.
+// ----------------------------------------------------------------------------
+struct PPF_HASH_MASK {
+  static uint64_t hash(uint64_t v){ return v; }
+};
+
+// Folds the upper bits in, for features whose low bits carry little entropy
+struct PPF_HASH_FOLD {
+  static uint64_t hash(uint64_t v){ return v ^ (v >> 12) ^ (v >> 24); }
+};
+
+template<uint32_t BITS, typename HASH = PPF_HASH_MASK>
+struct PPF_FEATURE {
+  static const uint32_t TABLE_BITS = BITS;
+  static const uint32_t TABLE_SIZE = 1u << BITS;
+  static uint32_t index(uint64_t v){ return HASH::hash(v) & (TABLE_SIZE - 1); }
+};
+
+// The hybrids' eight features, in the order they have always been passed
+struct PPF_FEAT_PF_BLOCK : PPF_FEATURE<12> {
+  static uint64_t value(const PPF_CONTEXT &c){ return c.pf_addr >> LOG2_BLOCK_SIZE; }
+};
+struct PPF_FEAT_PF_BLOCK_LOW : PPF_FEATURE<12> {
+  static uint64_t value(const PPF_CONTEXT &c){ return (c.pf_addr >> LOG2_BLOCK_SIZE) & 0xffffff; }
+};
+struct PPF_FEAT_IP_LOW : PPF_FEATURE<12> {
+  static uint64_t value(const PPF_CONTEXT &c){ return (c.last_ip >> LOG2_BLOCK_SIZE) & 0xffffff; }
+};
+struct PPF_FEAT_IP : PPF_FEATURE<12> {
+  static uint64_t value(const PPF_CONTEXT &c){ return c.last_ip >> LOG2_BLOCK_SIZE; }
+};
+struct PPF_FEAT_BRANCH_HIST : PPF_FEATURE<12> {
+  static uint64_t value(const PPF_CONTEXT &c){ return c.branch_history; }
+};
+struct PPF_FEAT_BRANCH_TARGET : PPF_FEATURE<12> {
+  static uint64_t value(const PPF_CONTEXT &c){ return c.last_b_target >> LOG2_BLOCK_SIZE; }
+};
+struct PPF_FEAT_LAST_PF : PPF_FEATURE<12> {
+  static uint64_t value(const PPF_CONTEXT &c){ return c.last_pf; }
+};
+struct PPF_FEAT_BRANCH_TYPES : PPF_FEATURE<12> {
+  static uint64_t value(const PPF_CONTEXT &c){ return c.b_type_hist; }
+};
+
+template<typename... FEATURES>
+struct PPF_FEATURES {
+  static const int NUM = sizeof...(FEATURES);
+};
+
+typedef PPF_FEATURES<PPF_FEAT_PF_BLOCK, PPF_FEAT_PF_BLOCK_LOW, PPF_FEAT_IP_LOW, PPF_FEAT_IP,
+                     PPF_FEAT_BRANCH_HIST, PPF_FEAT_BRANCH_TARGET, PPF_FEAT_LAST_PF,
+                     PPF_FEAT_BRANCH_TYPES> PPF_DEFAULT_FEATURES;
+
+// The member that generated the candidate. Its weight is a per-member bias
+struct PPF_FEAT_UNIT : PPF_FEATURE<2> {
+  static uint64_t value(const PPF_CONTEXT &c){ return c.puid; }
+};
+
+// One PPF for all members
+typedef PPF_FEATURES<PPF_FEAT_UNIT, PPF_FEAT_PF_BLOCK, PPF_FEAT_PF_BLOCK_LOW, PPF_FEAT_IP_LOW,
+                     PPF_FEAT_IP, PPF_FEAT_BRANCH_HIST, PPF_FEAT_BRANCH_TARGET, PPF_FEAT_LAST_PF,
+                     PPF_FEAT_BRANCH_TYPES> PPF_SHARED_FEATURES;
+
+// Which table indexes a feature has touched, for the unique index statistic
+class PPF_INDEX_SET {
+  public:
+    void resize(uint32_t n){ seen.assign(n, false); count = 0; }
+    void insert(uint32_t idx){
+      if(!seen[idx]){
+        seen[idx] = true;
+        count++;
+      }
+    }
+    size_t size() const { return count; }
+  private:
+    std::vector<bool> seen;
+    size_t count = 0;
+};
+
+// ----------------------------------------------------------------------------
+// Tracking table replacement. Each entry has an age, only compared within its
+// set, and victim() is only asked for a way once the set is full.
+// ----------------------------------------------------------------------------
+struct PPF_REPL_LRU {
+  template<typename ENTRY>
+  static uint32_t victim(ENTRY *set, uint32_t ways){
+    uint32_t way = 0;
+    for(uint32_t a = 1; a < ways; a++)
+      if(set[a].age > set[way].age)
+        way = a;
+    return way;
+  }
+
+  template<typename ENTRY>
+  static void hit(ENTRY *set, uint32_t ways, uint32_t way){
+    for(uint32_t a = 0; a < ways; a++)
+      if(set[a].valid && set[a].age < set[way].age)
+        set[a].age++;
+    set[way].age = 0;
+  }
+
+  template<typename ENTRY>
+  static void insert(ENTRY *set, uint32_t ways, uint32_t way){
+    set[way].age = ways;
+    hit(set, ways, way);
+  }
+};
+
+// 2-bit SRRIP: inserted as a distant re-reference, promoted on a hit
+struct PPF_REPL_RRIP {
+  static const uint8_t MAX_RRPV = 3;
+
+  template<typename ENTRY>
+  static uint32_t victim(ENTRY *set, uint32_t ways){
+    while(true){
+      for(uint32_t a = 0; a < ways; a++)
+        if(set[a].age == MAX_RRPV)
+          return a;
+      for(uint32_t a = 0; a < ways; a++)
+        set[a].age++;
+    }
+  }
+
+  template<typename ENTRY>
+  static void hit(ENTRY *set, uint32_t ways, uint32_t way){
+    set[way].age = 0;
+  }
+
+  template<typename ENTRY>
+  static void insert(ENTRY *set, uint32_t ways, uint32_t way){
+    set[way].age = MAX_RRPV - 1;
+  }
+};
+
+// ----------------------------------------------------------------------------
+// Shape of a tracking table. TAG_BITS below 64 keeps only that many low bits
+// of the block number, so two blocks of a set may alias.
+// ----------------------------------------------------------------------------
+template<uint32_t ENTRIES, uint32_t WAYS, uint32_t TAG_BITS, typename REPL>
+struct PPF_TRACKING {
+  static_assert(ENTRIES % WAYS == 0, "ENTRIES must be a multiple of WAYS");
+  static const uint32_t SIZE = ENTRIES;
+  static const uint32_t NUM_WAYS = WAYS;
+  static const uint32_t SETS = ENTRIES / WAYS;
+  static constexpr uint64_t TAG_MASK = TAG_BITS >= 64 ? ~0ull : (1ull << TAG_BITS) - 1;
+  typedef typename std::conditional<TAG_BITS <= 32, uint32_t, uint64_t>::type TAG;
+  typedef REPL REPLACEMENT;
+};
+
+// What ppf.cc does
+typedef PPF_TRACKING<TRACKING_TABLE_SIZE, 1, 64, PPF_REPL_LRU> PPF_DEFAULT_TRACKING;
+
+// ----------------------------------------------------------------------------
+// A tracking table of candidates and the weight indexes they were scored
+// with. The indexes are stored as IDX, the narrowest type that holds them.
+// ----------------------------------------------------------------------------
+template<typename CONFIG, int NUM_FEAT, typename IDX>
+class PPF_TRACKING_TABLE {
+  public:
+    struct ENTRY {
+      typename CONFIG::TAG tag;
+      IDX idx[NUM_FEAT];
+      bool valid;
+      bool trainable;         // ppf.cc does not train when address 0 is evicted
+      uint8_t age;
+    };
+
+    void clear(){
+      for(auto &e : entries)
+        e = ENTRY();
+    }
+
+    // Same hash as TRACKING_TABLE::get_hash, reduced to a set
+    static uint32_t set_of(uint64_t addr){
+      uint64_t hash = addr >> LOG2_BLOCK_SIZE;
+      hash += hash << 3;
+      hash ^= hash >> 11;
+      hash += hash << 15;
+      return hash % CONFIG::SETS;
+    }
+
+    void prefetch(uint32_t set) const {
+      __builtin_prefetch(&entries[set * CONFIG::NUM_WAYS]);
+    }
+
+    ENTRY *find(uint32_t set, uint64_t addr){
+      ENTRY *s = &entries[set * CONFIG::NUM_WAYS];
+      typename CONFIG::TAG tag = tag_of(addr);
+      for(uint32_t a = 0; a < CONFIG::NUM_WAYS; a++){
+        if(s[a].valid && s[a].tag == tag){
+          CONFIG::REPLACEMENT::hit(s, CONFIG::NUM_WAYS, a);
+          return &s[a];
+        }
+      }
+      return NULL;
+    }
+
+    // Inserts addr, copying the indexes of the entry it displaced to victim
+    // if that one should be trained on
+    bool insert(uint32_t set, uint64_t addr, const uint32_t *idx, uint32_t *victim){
+      ENTRY *s = &entries[set * CONFIG::NUM_WAYS];
+      typename CONFIG::TAG tag = tag_of(addr);
+      uint32_t way = CONFIG::NUM_WAYS;
+      for(uint32_t a = 0; a < CONFIG::NUM_WAYS; a++){
+        //Callers only insert addresses that are in neither table
+        assert(!s[a].valid || s[a].tag != tag);
+        if(!s[a].valid && way == CONFIG::NUM_WAYS)
+          way = a;
+      }
+      if(way == CONFIG::NUM_WAYS)
+        way = CONFIG::REPLACEMENT::victim(s, CONFIG::NUM_WAYS);
+
+      ENTRY &e = s[way];
+      bool evicted = e.valid && e.trainable;
+      if(evicted)
+        for(int a = 0; a < NUM_FEAT; a++)
+          victim[a] = e.idx[a];
+
+      e.valid = true;
+      e.trainable = addr != 0;
+      e.tag = tag;
+      for(int a = 0; a < NUM_FEAT; a++)
+        e.idx[a] = idx[a];
+      CONFIG::REPLACEMENT::insert(s, CONFIG::NUM_WAYS, way);
+      return evicted;
+    }
+
+  private:
+    ENTRY entries[CONFIG::SIZE];
+
+    static typename CONFIG::TAG tag_of(uint64_t addr){
+      return (addr >> LOG2_BLOCK_SIZE) & CONFIG::TAG_MASK;
+    }
+};
+
+template<typename FEATURE_LIST, typename TRACKING = PPF_DEFAULT_TRACKING> class STATIC_PPF;
+
+template<typename TRACKING, typename... FEATURES>
+class STATIC_PPF<PPF_FEATURES<FEATURES...>, TRACKING> {
+  public:
+    static constexpr int NUM_FEAT = sizeof...(FEATURES);
+
+    int MAX_FEAT = 0;
+    int TRAINING_THRESH = 0;
+    int FILTER_THRESHOLD = 0;
+    int L2_THRESHOLD = 0;
+
+    // The thresholds candidates of each member are held to, FILTER_THRESHOLD
+    // and L2_THRESHOLD unless set_unit_thresholds says otherwise
+    int unit_threshold[PPF_MAX_UNITS];
+    int unit_l2_threshold[PPF_MAX_UNITS];
+
+    int ppf_id = 0;
+    uint64_t last_ip = 0;
+
+    // Statistics, same meaning as in PPF
+    int accept_table_hit = 0;
+    int reject_table_hit = 0;
+    int increment_weight = 0;
+    int decrement_weight = 0;
+    int accept_trigger = 0;
+    int reject_trigger = 0;
+    int eviction_update = 0;
+    int sum_max = 0;
+    int sum_min = 0;
+    std::vector<uint64_t> sum_distro;
+    PPF_INDEX_SET unique_indexes[NUM_FEAT];
+
+    // The table sizes come from the descriptors, feat_table_s is only kept
+    // for the same call as PPF::initialize. The hybrids check max_feat
+    // against STATIC_PPF_MAX_FEAT when they read it from their config
+    void initialize(int max_feat, int feat_table_s, int training_thresh, int filter_thresh, int l2_thresh){
+      MAX_FEAT = max_feat;
+      TRAINING_THRESH = training_thresh;
+      set_thresholds(filter_thresh, l2_thresh);
+      assert(MAX_FEAT > 0);
+      //Weights are int8_t
+      assert(MAX_FEAT <= STATIC_PPF_MAX_FEAT);
+
+      //The gather reads 4 bytes from each weight's address, hence the padding
+      weights.assign(TOTAL_WEIGHTS + 3, 0);
+      sum_distro.assign(NUM_FEAT * 2, 0);
+      for(int a = 0; a < NUM_FEAT; a++)
+        unique_indexes[a].resize(TABLE_SIZES[a]);
+      reject_table.clear();
+      prefetch_table.clear();
+    }
+
+    // Every member's thresholds, for a PPF that serves a single member
+    void set_thresholds(int filter_thresh, int l2_thresh){
+      FILTER_THRESHOLD = filter_thresh;
+      L2_THRESHOLD = l2_thresh;
+      for(uint32_t a = 0; a < PPF_MAX_UNITS; a++)
+        set_unit_thresholds(a, filter_thresh, l2_thresh);
+    }
+
+    void set_unit_thresholds(uint32_t puid, int filter_thresh, int l2_thresh){
+      assert(puid < PPF_MAX_UNITS);
+      unit_threshold[puid] = filter_thresh;
+      unit_l2_threshold[puid] = l2_thresh;
+    }
+
+    bool check_filter(uint64_t addr, const PPF_CONTEXT &ctx){
+      return decide(addr, ctx, false) != PF_REJECT;
+    }
+
+    PF_LEVEL check_filter_level(uint64_t addr, const PPF_CONTEXT &ctx){
+      return decide(addr, ctx, true);
+    }
+
+    // ------------------------------------------------------------------------
+    // Trains on a demand access to addr if it was recently accepted or
+    // rejected, then forgets it
+    // ------------------------------------------------------------------------
+    void update_filter(uint64_t addr, bool cache_hit){
+      uint32_t set = TRACKING_TABLE_T::set_of(addr);
+      TRACKING_ENTRY *rej = reject_table.find(set, addr);
+      TRACKING_ENTRY *acc = prefetch_table.find(set, addr);
+
+      if(rej == NULL && acc == NULL)
+        return;
+
+      //An address should be present in only one of the tracking tables,
+      //unless partial tags alias, in which case the reject entry is used
+      assert(TRACKING::TAG_MASK != ~0ull || (rej == NULL) ^ (acc == NULL));
+
+      uint32_t idx[NUM_FEAT];
+      for(int a = 0; a < NUM_FEAT; a++)
+        idx[a] = (rej != NULL ? rej : acc)->idx[a];
+
+      if(rej != NULL){
+        reject_trigger++;
+        if(abs(sum(idx)) > TRAINING_THRESH)
+          return;
+        //Might have been a hit if the prefetch had been accepted
+        train(idx, !cache_hit ? 1 : -1);
+        rej->valid = false;
+      }else{
+        accept_trigger++;
+        if(abs(sum(idx)) > TRAINING_THRESH)
+          return;
+        train(idx, cache_hit ? 1 : -1);
+        acc->valid = false;
+      }
+    }
+
+    //Returns a distribution of a feature's weights
+    std::vector<uint64_t> get_feat_distro(int feat_num){
+      std::vector<uint64_t> weight_count((MAX_FEAT * 2)/8, 0);
+      for(uint32_t a = 0; a < TABLE_SIZES[feat_num]; a++){
+        int index = (weights[OFFSETS[feat_num] + a] + MAX_FEAT)/8;
+        if(index == (int)weight_count.size())
+          index = weight_count.size() - 1;
+        assert(index >= 0 && index < (int)weight_count.size());
+        weight_count[index]++;
+      }
+      return weight_count;
+    }
+
+    std::vector<uint64_t> get_sum_distro(){
+      return sum_distro;
+    }
+
+    // Only the weights, the tracking tables hold in-flight candidates.
+    // Register after initialize(), the size has to match on load
+    void register_checkpoint(HYBRID_CHECKPOINT &cp, const std::string &prefix){
+      cp.add_vector(prefix + "weights", &weights);
+    }
+
+    // ------------------------------------------------------------------------
+    // Decides on n candidates, in order, as check_filter_level (or
+    // check_filter if !multi_level) would, writing each decision to levels.
+    // The candidate's address is ctx[i].pf_addr.
+    //
+    // All indexes, sums and tracking table sets are computed first, while the
+    // table entries are prefetched. Deciding may train, so once a decision
+    // changes the weights the remaining sums are recomputed.
+    // ------------------------------------------------------------------------
+    void score_batch(const PPF_CONTEXT *ctx, uint32_t n, bool multi_level, PF_LEVEL *levels){
+      if(batch.size() < n)
+        batch.resize(n);
+
+      for(uint32_t a = 0; a < n; a++){
+        BATCH_ENTRY &b = batch[a];
+        b.set = TRACKING_TABLE_T::set_of(ctx[a].pf_addr);
+        reject_table.prefetch(b.set);
+        prefetch_table.prefetch(b.set);
+        make_indexes(ctx[a], b.idx, std::index_sequence_for<FEATURES...>());
+        b.sum = weight_sum(b.idx);
+      }
+
+      uint64_t scored_at = train_count;
+      for(uint32_t a = 0; a < n; a++){
+        BATCH_ENTRY &b = batch[a];
+        uint64_t addr = ctx[a].pf_addr;
+        if(probe(addr, b.set)){
+          levels[a] = PF_REJECT;
+          continue;
+        }
+        for(int c = 0; c < NUM_FEAT; c++)
+          unique_indexes[c].insert(b.idx[c]);
+        if(train_count != scored_at)
+          b.sum = weight_sum(b.idx);
+        levels[a] = decide_scored(addr, b.set, b.idx, b.sum, ctx[a].puid, multi_level);
+      }
+    }
+
+    // ------------------------------------------------------------------------
+    // Perceptron sums of n candidates without deciding on or tracking them,
+    // e.g. to look at a whole cycle's candidates before filtering them
+    // ------------------------------------------------------------------------
+    void score(const PPF_CONTEXT *ctx, uint32_t n, int *sums) const {
+      for(uint32_t a = 0; a < n; a++){
+        uint32_t idx[NUM_FEAT];
+        make_indexes(ctx[a], idx, std::index_sequence_for<FEATURES...>());
+        sums[a] = weight_sum(idx);
+      }
+    }
+
+  private:
+    static constexpr uint32_t TABLE_SIZES[NUM_FEAT] = {FEATURES::TABLE_SIZE...};
+
+    static constexpr uint32_t offset(int feat){
+      return feat == 0 ? 0 : offset(feat - 1) + TABLE_SIZES[feat - 1];
+    }
+
+    template<int... I>
+    static constexpr std::array<uint32_t, NUM_FEAT> make_offsets(std::integer_sequence<int, I...>){
+      return {{offset(I)...}};
+    }
+
+    static constexpr std::array<uint32_t, NUM_FEAT> OFFSETS = make_offsets(std::make_integer_sequence<int, NUM_FEAT>());
+    static constexpr uint32_t TOTAL_WEIGHTS = offset(NUM_FEAT - 1) + TABLE_SIZES[NUM_FEAT - 1];
+
+    // A tracked candidate keeps its weight indexes rather than its feature
+    // values, training only ever needs the indexes
+    typedef typename std::conditional<((FEATURES::TABLE_BITS <= 16) && ...), uint16_t, uint32_t>::type IDX;
+    typedef PPF_TRACKING_TABLE<TRACKING, NUM_FEAT, IDX> TRACKING_TABLE_T;
+    typedef typename TRACKING_TABLE_T::ENTRY TRACKING_ENTRY;
+
+    // A candidate of score_batch between its two passes
+    struct BATCH_ENTRY {
+      uint32_t set;
+      int sum;
+      uint32_t idx[NUM_FEAT];
+    };
+
+    std::vector<int8_t> weights;
+    TRACKING_TABLE_T reject_table;
+    TRACKING_TABLE_T prefetch_table;
+    std::vector<BATCH_ENTRY> batch;
+    //Number of train() calls, tells score_batch its sums are stale
+    uint64_t train_count = 0;
+
+    template<size_t... I>
+    static void make_indexes(const PPF_CONTEXT &ctx, uint32_t *idx, std::index_sequence<I...>){
+      ((idx[I] = FEATURES::index(FEATURES::value(ctx))), ...);
+    }
+
+    // Sum of the weights selected by idx
+    int weight_sum(const uint32_t *idx) const {
+      int s = 0;
+      int a = 0;
+#ifdef __AVX2__
+      //Gather 4 bytes at each weight and sign extend the low one
+      const int *base = (const int *)weights.data();
+      __m256i acc = _mm256_setzero_si256();
+      for(; a + 8 <= NUM_FEAT; a += 8){
+        __m256i i = _mm256_loadu_si256((const __m256i *)(idx + a));
+        __m256i o = _mm256_loadu_si256((const __m256i *)(OFFSETS.data() + a));
+        __m256i w = _mm256_i32gather_epi32(base, _mm256_add_epi32(i, o), 1);
+        acc = _mm256_add_epi32(acc, _mm256_srai_epi32(_mm256_slli_epi32(w, 24), 24));
+      }
+      __m128i x = _mm_add_epi32(_mm256_castsi256_si128(acc), _mm256_extracti128_si256(acc, 1));
+      x = _mm_add_epi32(x, _mm_shuffle_epi32(x, _MM_SHUFFLE(1, 0, 3, 2)));
+      x = _mm_add_epi32(x, _mm_shuffle_epi32(x, _MM_SHUFFLE(2, 3, 0, 1)));
+      s = _mm_cvtsi128_si32(x);
+#endif
+      for(; a < NUM_FEAT; a++)
+        s += weights[OFFSETS[a] + idx[a]];
+      return s;
+    }
+
+    int sum(const uint32_t *idx){
+      for(int a = 0; a < NUM_FEAT; a++)
+        unique_indexes[a].insert(idx[a]);
+      return weight_sum(idx);
+    }
+
+    void train(const uint32_t *idx, int dir){
+      train_count++;
+      for(int a = 0; a < NUM_FEAT; a++){
+        int8_t &w = weights[OFFSETS[a] + idx[a]];
+        if(abs(w) < MAX_FEAT){
+          w += dir;
+          if(dir > 0)
+            increment_weight++;
+          else
+            decrement_weight++;
+        }
+      }
+    }
+
+    void record_sum(int s){
+      int index = (s + MAX_FEAT * NUM_FEAT)/MAX_FEAT;
+      if(index == (int)sum_distro.size())
+        index = sum_distro.size() - 1;
+      assert(index >= 0 && index < (int)sum_distro.size());
+      sum_distro[index]++;
+    }
+
+    // ------------------------------------------------------------------------
+    // PPF::check_filter and check_filter_level in one. Accepted candidates go
+    // to the prefetch table, rejected ones to the reject table, and whatever
+    // they displace is trained as a useless prefetch.
+    // ------------------------------------------------------------------------
+    PF_LEVEL decide(uint64_t addr, const PPF_CONTEXT &ctx, bool multi_level){
+      uint32_t set = TRACKING_TABLE_T::set_of(addr);
+      if(probe(addr, set))
+        return PF_REJECT;
+
+      uint32_t idx[NUM_FEAT];
+      make_indexes(ctx, idx, std::index_sequence_for<FEATURES...>());
+      return decide_scored(addr, set, idx, sum(idx), ctx.puid, multi_level);
+    }
+
+    //Whether addr was recently requested as a prefetch, in which case it is
+    //not re-prefetched
+    bool probe(uint64_t addr, uint32_t set){
+      if(reject_table.find(set, addr) != NULL){
+        reject_table_hit++;
+        return true;
+      }
+      if(prefetch_table.find(set, addr) != NULL){
+        accept_table_hit++;
+        return true;
+      }
+      return false;
+    }
+
+    //The decision for member puid's candidate that is in neither table and
+    //sums to s
+    PF_LEVEL decide_scored(uint64_t addr, uint32_t set, const uint32_t *idx, int s, uint32_t puid, bool multi_level){
+      assert(puid < PPF_MAX_UNITS);
+      if(s > sum_max)
+        sum_max = s;
+      if(s < sum_min)
+        sum_min = s;
+
+      bool accept = s > unit_threshold[puid];
+      PF_LEVEL level = accept ? PF_L1 : (multi_level && s > unit_l2_threshold[puid] ? PF_L2 : PF_REJECT);
+
+      if(accept)
+        record_sum(s);
+
+      uint32_t victim[NUM_FEAT];
+      if(!(accept ? prefetch_table : reject_table).insert(set, addr, idx, victim))
+        return level;
+
+      eviction_update++;
+      if(!accept)
+        record_sum(s);
+
+      //Teach that the displaced candidate was a useless prefetch, if the
+      //training rules are met
+      if(abs(sum(victim)) <= TRAINING_THRESH)
+        train(victim, -1);
+
+      return level;
+    }
+};
+
+// ----------------------------------------------------------------------------
+// ppf.cc's PPF behind the same PPF_CONTEXT interface, for comparing against
+// STATIC_PPF or trying feature sets the descriptors cannot express
+// ----------------------------------------------------------------------------
+template<typename FEATURE_LIST> class PPF_ADAPTER;
+
+template<typename... FEATURES>
+class PPF_ADAPTER<PPF_FEATURES<FEATURES...>> : public PPF {
+  public:
+    using PPF::check_filter;
+    using PPF::check_filter_level;
+
+    bool check_filter(uint64_t addr, const PPF_CONTEXT &ctx){
+      return PPF::check_filter(addr, {FEATURES::value(ctx)...});
+    }
+
+    PF_LEVEL check_filter_level(uint64_t addr, const PPF_CONTEXT &ctx){
+      return PPF::check_filter_level(addr, {FEATURES::value(ctx)...});
+    }
+
+    void score_batch(const PPF_CONTEXT *ctx, uint32_t n, bool multi_level, PF_LEVEL *levels){
+      for(uint32_t a = 0; a < n; a++){
+        if(multi_level)
+          levels[a] = check_filter_level(ctx[a].pf_addr, ctx[a]);
+        else
+          levels[a] = check_filter(ctx[a].pf_addr, ctx[a]) ? PF_L1 : PF_REJECT;
+      }
+    }
+
+    void set_thresholds(int filter_thresh, int l2_thresh){
+      FILTER_THRESHOLD = filter_thresh;
+      L2_THRESHOLD = l2_thresh;
+    }
+
+    // One PPF per member, so puid is not needed
+    void set_unit_thresholds(uint32_t puid, int filter_thresh, int l2_thresh){
+      set_thresholds(filter_thresh, l2_thresh);
+    }
+
+    // PPF's tables are not checkpointed
+    void register_checkpoint(HYBRID_CHECKPOINT &cp, const std::string &prefix){}
+};
+
+#endif
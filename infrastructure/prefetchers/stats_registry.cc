@@ -0,0 +1,243 @@
+#include "stats_registry.h"
+#include <cassert>
+#include <cstdlib>
+#include <cstring>
+
+using namespace std;
+
+// Magic at the start of every binary stats file, followed by the schema
+static const char STATS_MAGIC[8] = {'H','Y','B','S','T','A','T','1'};
+
+STATS_REGISTRY::~STATS_REGISTRY(){
+  if(epoch_file != NULL)
+    fclose(epoch_file);
+}
+
+void STATS_REGISTRY::configure(const char *default_path, STATS_FORMAT default_format, uint64_t default_epoch){
+  path = default_path;
+  format = default_format;
+  epoch_length = default_epoch;
+
+  if(const char *val = getenv("HYBRID_STATS_FILE"))
+    path = val;
+
+  if(const char *val = getenv("HYBRID_STATS_FORMAT")){
+    if(strcmp(val, "json") == 0)
+      format = STATS_JSON;
+    else if(strcmp(val, "csv") == 0)
+      format = STATS_CSV;
+    else if(strcmp(val, "bin") == 0)
+      format = STATS_BINARY;
+    else
+      printf("Unknown HYBRID_STATS_FORMAT %s, keeping default\n", val);
+  }
+
+  if(const char *val = getenv("HYBRID_STATS_EPOCH"))
+    epoch_length = strtoull(val, NULL, 10);
+
+  //Nowhere to write to
+  if(path.empty())
+    epoch_length = 0;
+}
+
+void STATS_REGISTRY::add_function(const string &name, function<vector<uint64_t>()> fn){
+  STATS_ENTRY e;
+  e.name = name;
+  e.is_float = false;
+  e.get_ints = [fn](vector<int64_t> &out){
+    for(auto v : fn())
+      out.push_back(v);
+  };
+  entries.push_back(e);
+}
+
+void STATS_REGISTRY::add_function(const string &name, function<double()> fn){
+  STATS_ENTRY e;
+  e.name = name;
+  e.is_float = true;
+  e.get_floats = [fn](vector<double> &out){ out.push_back(fn()); };
+  entries.push_back(e);
+}
+
+// ----------------------------------------------------------------------------
+// Per-epoch snapshots go to <path>.epochs so the final dump stays a single,
+// self-contained object. JSON snapshots are written one object per line.
+// ----------------------------------------------------------------------------
+void STATS_REGISTRY::snapshot(){
+  if(path.empty())
+    return;
+
+  if(epoch_file == NULL){
+    string epoch_path = path + ".epochs";
+    epoch_file = fopen(epoch_path.c_str(), format == STATS_BINARY ? "wb" : "w");
+    if(epoch_file == NULL){
+      printf("Could not open %s, disabling per-epoch stats\n", epoch_path.c_str());
+      epoch_length = 0;
+      return;
+    }
+  }
+
+  switch(format){
+    case STATS_JSON:
+      dump_json(epoch_file, epoch_count);
+      break;
+    case STATS_CSV:
+      dump_csv(epoch_file, epoch_count, !schema_written);
+      break;
+    case STATS_BINARY:
+      dump_binary(epoch_file, epoch_count, !schema_written);
+      break;
+  }
+  schema_written = true;
+  epoch_count++;
+}
+
+void STATS_REGISTRY::dump(){
+  if(path.empty())
+    return;
+
+  FILE *f = fopen(path.c_str(), format == STATS_BINARY ? "wb" : "w");
+  if(f == NULL){
+    printf("Could not open %s for the final stats dump\n", path.c_str());
+    return;
+  }
+
+  switch(format){
+    case STATS_JSON:
+      dump_json(f, -1);
+      break;
+    case STATS_CSV:
+      dump_csv(f, -1, true);
+      break;
+    case STATS_BINARY:
+      dump_binary(f, -1, true);
+      break;
+  }
+  fclose(f);
+
+  if(epoch_file != NULL)
+    fflush(epoch_file);
+}
+
+// ----------------------------------------------------------------------------
+// {"name": value, "array": [v0, v1, ...], ...}. Per-epoch objects are wrapped
+// as {"epoch": N, "stats": {...}} on a single line.
+// ----------------------------------------------------------------------------
+void STATS_REGISTRY::dump_json(FILE *f, int64_t epoch){
+  vector<int64_t> ints;
+  vector<double> floats;
+
+  if(epoch >= 0)
+    fprintf(f, "{\"epoch\": %ld, \"stats\": {", epoch);
+  else
+    fprintf(f, "{\n");
+
+  for(size_t a = 0; a < entries.size(); a++){
+    ints.clear();
+    floats.clear();
+    size_t n = 0;
+    if(entries[a].is_float){
+      entries[a].get_floats(floats);
+      n = floats.size();
+    }else{
+      entries[a].get_ints(ints);
+      n = ints.size();
+    }
+
+    fprintf(f, "%s\"%s\": ", epoch >= 0 ? "" : "  ", entries[a].name.c_str());
+    if(n != 1)
+      fprintf(f, "[");
+    for(size_t b = 0; b < n; b++){
+      if(entries[a].is_float)
+        fprintf(f, "%.9g", floats[b]);
+      else
+        fprintf(f, "%ld", ints[b]);
+      if(b + 1 < n)
+        fprintf(f, ", ");
+    }
+    if(n != 1)
+      fprintf(f, "]");
+
+    if(a + 1 < entries.size())
+      fprintf(f, epoch >= 0 ? ", " : ",\n");
+  }
+
+  if(epoch >= 0)
+    fprintf(f, "}}\n");
+  else
+    fprintf(f, "\n}\n");
+}
+
+// ----------------------------------------------------------------------------
+// Long format, one value per row: [epoch,]name,index,value
+// ----------------------------------------------------------------------------
+void STATS_REGISTRY::dump_csv(FILE *f, int64_t epoch, bool header){
+  vector<int64_t> ints;
+  vector<double> floats;
+
+  if(header)
+    fprintf(f, epoch >= 0 ? "epoch,name,index,value\n" : "name,index,value\n");
+
+  for(auto &e : entries){
+    ints.clear();
+    floats.clear();
+    if(e.is_float)
+      e.get_floats(floats);
+    else
+      e.get_ints(ints);
+
+    size_t n = e.is_float ? floats.size() : ints.size();
+    for(size_t b = 0; b < n; b++){
+      if(epoch >= 0)
+        fprintf(f, "%ld,", epoch);
+      if(e.is_float)
+        fprintf(f, "%s,%lu,%.9g\n", e.name.c_str(), b, floats[b]);
+      else
+        fprintf(f, "%s,%lu,%ld\n", e.name.c_str(), b, ints[b]);
+    }
+  }
+}
+
+// ----------------------------------------------------------------------------
+// Binary layout, little endian as written by the host:
+//   schema: magic[8], uint32 num_entries, then per entry
+//           uint32 name_len, name bytes, uint8 is_float
+//   record: int64 epoch (-1 for the final dump), then per entry
+//           uint32 count, count x (int64 or double)
+// The schema is written once, followed by one record per snapshot.
+// ----------------------------------------------------------------------------
+void STATS_REGISTRY::dump_binary(FILE *f, int64_t epoch, bool schema){
+  if(schema){
+    fwrite(STATS_MAGIC, 1, sizeof(STATS_MAGIC), f);
+    uint32_t num = entries.size();
+    fwrite(&num, sizeof(num), 1, f);
+    for(auto &e : entries){
+      uint32_t len = e.name.size();
+      uint8_t is_float = e.is_float;
+      fwrite(&len, sizeof(len), 1, f);
+      fwrite(e.name.data(), 1, len, f);
+      fwrite(&is_float, sizeof(is_float), 1, f);
+    }
+  }
+
+  fwrite(&epoch, sizeof(epoch), 1, f);
+
+  vector<int64_t> ints;
+  vector<double> floats;
+  for(auto &e : entries){
+    ints.clear();
+    floats.clear();
+    uint32_t n = 0;
+    if(e.is_float){
+      e.get_floats(floats);
+      n = floats.size();
+      fwrite(&n, sizeof(n), 1, f);
+      fwrite(floats.data(), sizeof(double), n, f);
+    }else{
+      e.get_ints(ints);
+      n = ints.size();
+      fwrite(&n, sizeof(n), 1, f);
+      fwrite(ints.data(), sizeof(int64_t), n, f);
+    }
+  }
+}
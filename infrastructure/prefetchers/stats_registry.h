@@ -0,0 +1,96 @@
+#ifndef STATS_REGISTRY_H
+#define STATS_REGISTRY_H
+
+#include <cstdint>
+#include <cstdio>
+#include <functional>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+// ----------------------------------------------------------------------------
+// Machine-readable statistics for the hybrids. Every component registers its
+// counters once (usually from l1i_prefetcher_initialize) under a dotted name,
+// e.g. "ppf1.accept_table_hit", and the registry samples them when dumping.
+// The final dump and the optional per-epoch snapshots can be written as JSON,
+// CSV (name,index,value rows) or a compact binary file (see dump_binary).
+// ----------------------------------------------------------------------------
+
+enum STATS_FORMAT { STATS_JSON, STATS_CSV, STATS_BINARY };
+
+// One named statistic. Scalars are stored as vectors of length one so that
+// all three writers handle counters, arrays and distributions the same way.
+struct STATS_ENTRY {
+  std::string name;
+  bool is_float;
+  std::function<void(std::vector<int64_t>&)> get_ints;
+  std::function<void(std::vector<double>&)> get_floats;
+};
+
+class STATS_REGISTRY {
+  public:
+    std::vector<STATS_ENTRY> entries;
+
+    // Where, how and how often to dump. Set by configure()
+    std::string path;
+    STATS_FORMAT format;
+    uint64_t epoch_length;
+    uint64_t epoch_count;
+
+    STATS_REGISTRY() : format(STATS_JSON), epoch_length(0), epoch_count(0), epoch_file(NULL), schema_written(false) {}
+    ~STATS_REGISTRY();
+
+    // Defaults come from the hybrid's #defines, and can be overridden by
+    // HYBRID_STATS_FILE, HYBRID_STATS_FORMAT (json, csv, bin) and
+    // HYBRID_STATS_EPOCH. An empty path disables all file output.
+    void configure(const char *default_path, STATS_FORMAT default_format, uint64_t default_epoch);
+
+    // Registers a single counter (integral or floating point) by address
+    template<typename T>
+    void add_counter(const std::string &name, const T *val){
+      add_array(name, val, 1);
+    }
+
+    // Registers a fixed size array of counters by address
+    template<typename T>
+    void add_array(const std::string &name, const T *vals, size_t n){
+      static_assert(std::is_arithmetic<T>::value, "stats must be arithmetic");
+      STATS_ENTRY e;
+      e.name = name;
+      e.is_float = std::is_floating_point<T>::value;
+      if(e.is_float)
+        e.get_floats = [vals, n](std::vector<double> &out){ for(size_t a = 0; a < n; a++) out.push_back(vals[a]); };
+      else
+        e.get_ints = [vals, n](std::vector<int64_t> &out){ for(size_t a = 0; a < n; a++) out.push_back(vals[a]); };
+      entries.push_back(e);
+    }
+
+    // Registers a value computed at dump time, e.g. a weight distribution
+    void add_function(const std::string &name, std::function<std::vector<uint64_t>()> fn);
+    void add_function(const std::string &name, std::function<double()> fn);
+
+    // Counts L1I accesses and writes a snapshot every epoch_length of them
+    void tick(){
+      if(epoch_length == 0 || ++epoch_ticks < epoch_length)
+        return;
+      epoch_ticks = 0;
+      snapshot();
+    }
+
+    // Appends the current values of every entry to the per-epoch file
+    void snapshot();
+
+    // Writes the final values of every entry to path
+    void dump();
+
+    void dump_json(FILE *f, int64_t epoch);
+    void dump_csv(FILE *f, int64_t epoch, bool header);
+    void dump_binary(FILE *f, int64_t epoch, bool schema);
+
+  private:
+    uint64_t epoch_ticks = 0;
+    FILE *epoch_file;
+    bool schema_written;
+};
+
+#endif
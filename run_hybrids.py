@@ -0,0 +1,387 @@
+import os
+import sys
+import json
+import time
+import shutil
+import hashlib
+import argparse
+import threading
+import subprocess
+import collections
+import re
+
+# Builds and runs every combination listed in the manifest written by
+# create_hybrids.py on every trace in a trace list, using all cores.
+#
+# 1. One builder thread configures and builds the combinations one at a time
+#    (they share a single ChampSim tree, so builds cannot overlap) and keeps
+#    each binary in the cache.
+# 2. As soon as a combination is built, its runs are spread over the
+#    workers' queues, longest trace first.
+# 3. Every worker takes work from the front of its own queue and, when that
+#    is empty, steals the longest run still queued anywhere.
+#
+# Results are cached by the sha256 of the combination's sources and config,
+# the build command, the ChampSim tree (its commit and uncommitted changes),
+# the trace contents and the run command, so unchanged combinations are
+# never rebuilt or re-run. --force rebuilds each binary once per invocation. The config's "hybrid" section is only read by the
+# binary at runtime (see hybrid_config.h), so it is left out of the build
+# hash: manifest entries that share a directory and differ only in that
+# section, e.g. the points of a threshold sweep, are built once.
+#
+# The trace list has one trace path per line, optionally followed by a
+# weight used to order the runs (defaults to the file size). Lines starting
+# with '#' are ignored.
+#
+# e.g. python3 run_hybrids.py --champsim ~/ChampSim --traces traces.txt
+
+DEFAULT_BUILD_CMD = './config.sh {config} && make'
+DEFAULT_RUN_CMD = '{binary} --warmup_instructions {warmup} --simulation_instructions {sim} {trace}'
+
+# ChampSim's summary line, used for the results table
+IPC_RE = re.compile(r'CPU 0 cumulative IPC: ([0-9.]+)')
+
+
+def sha256_file(path, h=None):
+  if h is None:
+    h = hashlib.sha256()
+  with open(path, 'rb') as f:
+    for chunk in iter(lambda: f.read(1 << 20), b''):
+      h.update(chunk)
+  return h
+
+
+class TraceHashes:
+  """Content hashes of the traces. Traces are large, so the hashes are kept
+  in the cache keyed by path, size and mtime and only recomputed when one of
+  those changes."""
+
+  def __init__(self, cache_dir):
+    self.path = os.path.join(cache_dir, 'trace_hashes.json')
+    self.hashes = {}
+    if os.path.exists(self.path):
+      with open(self.path) as f:
+        self.hashes = json.load(f)
+
+  def get(self, trace):
+    st = os.stat(trace)
+    key = '%s:%d:%d' % (os.path.abspath(trace), st.st_size, int(st.st_mtime))
+    if key not in self.hashes:
+      self.hashes[key] = sha256_file(trace).hexdigest()
+    return self.hashes[key]
+
+  def save(self):
+    with open(self.path, 'w') as f:
+      json.dump(self.hashes, f, indent=2)
+
+
+def split_config(path):
+  """The config without its "hybrid" section, and that section, both as
+  canonical JSON"""
+  with open(path) as f:
+    config = json.load(f)
+  runtime = config.pop('hybrid', {})
+  return json.dumps(config, sort_keys=True), json.dumps(runtime, sort_keys=True)
+
+
+def tree_digest(champsim):
+  """The ChampSim tree's commit and uncommitted changes to tracked files, or
+  the contents of its sources if it is not a git checkout. Files the builds
+  generate are untracked, so they do not change it"""
+  h = hashlib.sha256()
+  try:
+    h.update(subprocess.check_output(['git', 'rev-parse', 'HEAD'], cwd=champsim, stderr=subprocess.DEVNULL))
+    h.update(subprocess.check_output(['git', 'diff', 'HEAD'], cwd=champsim, stderr=subprocess.DEVNULL))
+    return h.hexdigest()
+  except (OSError, subprocess.CalledProcessError):
+    pass
+  for top in ['inc', 'src', 'branch', 'prefetcher', 'replacement', 'btb']:
+    for root, dirs, files in os.walk(os.path.join(champsim, top)):
+      dirs.sort()
+      for name in sorted(files):
+        path = os.path.join(root, name)
+        h.update(os.path.relpath(path, champsim).encode())
+        sha256_file(path, h)
+  for name in ['Makefile', 'config.sh']:
+    path = os.path.join(champsim, name)
+    if os.path.isfile(path):
+      sha256_file(path, h)
+  return h.hexdigest()
+
+
+def source_hash(comb, gen_dir, build_key):
+  """sha256 over every file of the combination's directory and its config,
+  except the config's runtime section, and build_key (the build command and
+  the ChampSim tree)"""
+  h = hashlib.sha256()
+  h.update(build_key.encode())
+  comb_dir = os.path.join(gen_dir, comb['dir'])
+  for name in sorted(os.listdir(comb_dir)):
+    path = os.path.join(comb_dir, name)
+    if os.path.isfile(path):
+      h.update(name.encode())
+      sha256_file(path, h)
+  h.update(split_config(os.path.join(gen_dir, comb['config']))[0].encode())
+  return h.hexdigest()
+
+
+class Job:
+  def __init__(self, comb, trace, weight, key, binary, config):
+    self.comb = comb
+    self.trace = trace
+    self.weight = weight
+    self.key = key
+    self.binary = binary
+    self.config = config
+
+
+class WorkQueues:
+  """One deque per worker. Owners pop from the front, thieves take the
+  heaviest job still queued in any of them."""
+
+  def __init__(self, num_workers):
+    self.queues = [collections.deque() for _ in range(num_workers)]
+    self.pending = [0] * num_workers
+    self.cond = threading.Condition()
+    self.producer_done = False
+    self.next_queue = 0
+
+  def push_all(self, jobs):
+    # Longest first, dealt round-robin so every worker gets a long one
+    with self.cond:
+      for job in sorted(jobs, key=lambda j: -j.weight):
+        q = self.next_queue
+        self.next_queue = (self.next_queue + 1) % len(self.queues)
+        self.queues[q].append(job)
+        self.pending[q] += job.weight
+      self.cond.notify_all()
+
+  def finish(self):
+    with self.cond:
+      self.producer_done = True
+      self.cond.notify_all()
+
+  def get(self, worker):
+    with self.cond:
+      while True:
+        if self.queues[worker]:
+          job = self.queues[worker].popleft()
+          self.pending[worker] -= job.weight
+          return job, False
+        # Queues are only sorted within one push_all, so look at every job
+        victim, job = None, None
+        for q, queue in enumerate(self.queues):
+          for j in queue:
+            if job is None or j.weight > job.weight:
+              victim, job = q, j
+        if job is not None:
+          self.queues[victim].remove(job)
+          self.pending[victim] -= job.weight
+          return job, True
+        if self.producer_done:
+          return None, False
+        self.cond.wait()
+
+
+class Runner:
+  def __init__(self, args, manifest, traces):
+    self.args = args
+    self.manifest = manifest
+    self.traces = traces
+    self.gen_dir = os.path.dirname(os.path.abspath(args.manifest))
+    self.queues = WorkQueues(args.jobs)
+    self.trace_hashes = TraceHashes(args.cache)
+    self.lock = threading.Lock()
+    self.results = []
+    self.steals = 0
+    # Whether each binary this invocation built succeeded, so that --force
+    # does not build it again for the next manifest entry sharing it
+    self.built = {}
+    h = hashlib.sha256()
+    h.update(args.build_cmd.encode())
+    h.update(tree_digest(args.champsim).encode())
+    self.build_key = h.hexdigest()
+
+  def log(self, msg):
+    with self.lock:
+      print(msg)
+      sys.stdout.flush()
+
+  def record(self, comb, trace, status, seconds, cached, out_path):
+    ipc = ''
+    if out_path is not None and os.path.exists(out_path):
+      with open(out_path, errors='replace') as f:
+        m = IPC_RE.search(f.read())
+        if m:
+          ipc = m.group(1)
+    with self.lock:
+      self.results.append([comb['name'], trace, status, '%.1f' % seconds, int(cached), ipc])
+
+  def result_path(self, comb, trace):
+    d = os.path.join(self.args.results, comb['name'])
+    os.makedirs(d, exist_ok=True)
+    return os.path.join(d, os.path.basename(trace) + '.out')
+
+  # --------------------------------------------------------------------------
+  # Builder: one combination at a time, then hand its runs to the workers
+  # --------------------------------------------------------------------------
+  def build_all(self):
+    for comb in self.manifest:
+      src_key = source_hash(comb, self.gen_dir, self.build_key)
+      config = os.path.join(self.gen_dir, comb['config'])
+      runtime = split_config(config)[1]
+      binary = os.path.join(self.args.cache, 'bin', src_key)
+      jobs = []
+      for trace, weight in self.traces:
+        h = hashlib.sha256()
+        h.update(src_key.encode())
+        h.update(runtime.encode())
+        h.update(self.trace_hashes.get(trace).encode())
+        h.update(self.args.run_cmd.encode())
+        h.update(('%d %d' % (self.args.warmup, self.args.sim)).encode())
+        key = h.hexdigest()
+        cached = os.path.join(self.args.cache, 'runs', key + '.out')
+        if os.path.exists(cached) and not self.args.force:
+          shutil.copy2(cached, self.result_path(comb, trace))
+          self.record(comb, trace, 'ok', 0, True, cached)
+          continue
+        jobs.append(Job(comb, trace, weight, key, binary, config))
+
+      if not jobs:
+        self.log('%s: all runs cached' % comb['name'])
+        continue
+
+      if src_key not in self.built and (not os.path.exists(binary) or self.args.force):
+        self.built[src_key] = self.build(comb, binary)
+      if not self.built.get(src_key, True):
+        for job in jobs:
+          self.record(comb, job.trace, 'build_failed', 0, False, None)
+        continue
+
+      self.queues.push_all(jobs)
+    self.queues.finish()
+
+  def build(self, comb, binary):
+    cmd = self.args.build_cmd.format(config=os.path.join(self.gen_dir, comb['config']),
+                                     name=comb['name'], dir=comb['dir'])
+    self.log('%s: building' % comb['name'])
+    log_path = os.path.join(self.args.results, comb['name'] + '.build.log')
+    start = time.time()
+    if self.args.dry_run:
+      self.log('  ' + cmd)
+      return True
+    with open(log_path, 'w') as log:
+      rc = subprocess.call(cmd, shell=True, cwd=self.args.champsim, stdout=log, stderr=subprocess.STDOUT)
+    built = os.path.join(self.args.champsim, 'bin', comb['name'])
+    if rc != 0 or not os.path.exists(built):
+      self.log('%s: build failed, see %s' % (comb['name'], log_path))
+      return False
+    shutil.copy2(built, binary)
+    self.log('%s: built in %.0fs' % (comb['name'], time.time() - start))
+    return True
+
+  # --------------------------------------------------------------------------
+  # Workers: run simulations until the builder is done and all queues drain
+  # --------------------------------------------------------------------------
+  def work(self, worker):
+    while True:
+      job, stolen = self.queues.get(worker)
+      if job is None:
+        return
+      if stolen:
+        with self.lock:
+          self.steals += 1
+      self.run(job)
+
+  def run(self, job):
+    cmd = self.args.run_cmd.format(binary=job.binary, trace=job.trace,
+                                   warmup=self.args.warmup, sim=self.args.sim)
+    out_path = self.result_path(job.comb, job.trace)
+    if self.args.dry_run:
+      self.log('  ' + cmd)
+      return
+    start = time.time()
+    # The hybrid reads its runtime parameters from the combination's config
+    env = dict(os.environ, HYBRID_CONFIG=job.config)
+    with open(out_path, 'w') as out:
+      rc = subprocess.call(cmd, shell=True, stdout=out, stderr=subprocess.STDOUT, env=env)
+    seconds = time.time() - start
+    if rc == 0:
+      shutil.copy2(out_path, os.path.join(self.args.cache, 'runs', job.key + '.out'))
+      status = 'ok'
+    else:
+      status = 'failed(%d)' % rc
+    self.log('%s %s: %s in %.0fs' % (job.comb['name'], os.path.basename(job.trace), status, seconds))
+    self.record(job.comb, job.trace, status, seconds, False, out_path)
+
+  def start(self):
+    workers = [threading.Thread(target=self.work, args=(w,)) for w in range(self.args.jobs)]
+    for w in workers:
+      w.start()
+    try:
+      self.build_all()
+    finally:
+      self.queues.finish()
+      for w in workers:
+        w.join()
+      self.trace_hashes.save()
+
+    summary = os.path.join(self.args.results, 'summary.csv')
+    with open(summary, 'w') as f:
+      f.write('combination,trace,status,seconds,cached,ipc\n')
+      for r in sorted(self.results):
+        f.write(','.join(str(v) for v in r) + '\n')
+    failed = sum(1 for r in self.results if r[2] != 'ok')
+    print('%d runs, %d failed, %d steals, summary in %s' % (len(self.results), failed, self.steals, summary))
+    return failed == 0
+
+
+def read_traces(path):
+  traces = []
+  with open(path) as f:
+    for line in f:
+      line = line.strip()
+      if not line or line.startswith('#'):
+        continue
+      parts = line.split()
+      trace = os.path.abspath(parts[0])
+      weight = float(parts[1]) if len(parts) > 1 else os.path.getsize(trace)
+      traces.append((trace, weight))
+  return traces
+
+
+def main():
+  parser = argparse.ArgumentParser(description='Build and run the generated hybrid combinations')
+  parser.add_argument('--manifest', default='hybrids_manifest.json', help='written by create_hybrids.py')
+  parser.add_argument('--traces', required=True, help='trace list, one path [weight] per line')
+  parser.add_argument('--champsim', required=True, help='ChampSim tree the builds run in')
+  parser.add_argument('--only', default='', help='only combinations whose name contains this')
+  parser.add_argument('--jobs', type=int, default=os.cpu_count(), help='simulations to run at once')
+  parser.add_argument('--warmup', type=int, default=50000000)
+  parser.add_argument('--sim', type=int, default=100000000)
+  parser.add_argument('--results', default='results')
+  parser.add_argument('--cache', default='.hybrid_cache')
+  parser.add_argument('--build-cmd', default=DEFAULT_BUILD_CMD, help='run in --champsim; {config} {name} {dir}')
+  parser.add_argument('--run-cmd', default=DEFAULT_RUN_CMD, help='{binary} {trace} {warmup} {sim}')
+  parser.add_argument('--force', action='store_true', help='rebuild every binary once and ignore cached results')
+  parser.add_argument('--dry-run', action='store_true', help='print the commands instead of running them')
+  args = parser.parse_args()
+
+  with open(args.manifest) as f:
+    manifest = [c for c in json.load(f) if args.only in c['name']]
+  traces = read_traces(args.traces)
+
+  args.champsim = os.path.abspath(args.champsim)
+  args.results = os.path.abspath(args.results)
+  args.cache = os.path.abspath(args.cache)
+  os.makedirs(args.results, exist_ok=True)
+  os.makedirs(os.path.join(args.cache, 'bin'), exist_ok=True)
+  os.makedirs(os.path.join(args.cache, 'runs'), exist_ok=True)
+
+  print('%d combinations x %d traces on %d workers' % (len(manifest), len(traces), args.jobs))
+  ok = Runner(args, manifest, traces).start()
+  sys.exit(0 if ok else 1)
+
+
+if __name__ == '__main__':
+  main()